@@ -0,0 +1,313 @@
+#include "MemoryTracker.h"
+#include "big_quokka.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace quokka
+{
+  // Everything here is constant-initialized: operator new can run before any
+  // dynamic initializer of this file.
+  namespace
+  {
+    const int STRIPE_BITS = 6;
+    const int STRIPES = 1 << STRIPE_BITS;
+    const unsigned int MIN_CAPACITY = 64;
+
+    void* const TOMBSTONE = (void*)1;
+
+    // trivially destructible, unlike std::mutex, so allocations made by
+    // other static destructors at exit still find a usable lock
+    struct SpinLock
+    {
+      std::atomic<bool> Locked;
+
+      void lock()
+      {
+        while (Locked.exchange(true, std::memory_order_acquire))
+          while (Locked.load(std::memory_order_relaxed))
+            std::this_thread::yield();
+      }
+
+      void unlock() { Locked.store(false, std::memory_order_release); }
+    };
+
+    struct Slot
+    {
+      void* Ptr;
+      size_t Size;
+      int Tag;
+    };
+
+    // open addressing with linear probing, tables come from calloc so the
+    // tracker never re-enters operator new
+    struct Stripe
+    {
+      SpinLock Lock;
+      Slot* Slots;
+      unsigned int Capacity;
+      unsigned int Used;      // live slots and tombstones
+      unsigned int Live;
+    };
+
+    struct Counter
+    {
+      std::atomic<unsigned long long> Current;
+      std::atomic<unsigned long long> Peak;
+      std::atomic<unsigned long long> Allocations;
+      std::atomic<unsigned long long> Live;
+    };
+
+    Stripe Stripes[STRIPES];
+    Counter Tags[MEMORY_TAG_COUNT];
+    Counter Total;
+    std::atomic<unsigned long long> ClassAllocations[MEMORY_SIZE_CLASSES];
+    std::atomic<unsigned long long> ClassLive[MEMORY_SIZE_CLASSES];
+
+    thread_local int CurrentTag = MEMORY_TAG_OTHER;
+
+    unsigned long long HashPointer(void* Ptr)
+    {
+      return (unsigned long long)(size_t)Ptr * 0x9E3779B97F4A7C15ull;
+    }
+
+    int SizeClass(size_t Size)
+    {
+      return Size < 2 ? 0 : HighestBit((uint64)Size);
+    }
+
+    void RaisePeak(std::atomic<unsigned long long>& Peak, unsigned long long Value)
+    {
+      unsigned long long Seen = Peak.load(std::memory_order_relaxed);
+      while (Value > Seen && !Peak.compare_exchange_weak(Seen, Value, std::memory_order_relaxed))
+      {
+      }
+    }
+
+    void AddToCounter(Counter& C, size_t Size)
+    {
+      unsigned long long Now = C.Current.fetch_add(Size, std::memory_order_relaxed) + Size;
+      RaisePeak(C.Peak, Now);
+      C.Allocations.fetch_add(1, std::memory_order_relaxed);
+      C.Live.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void RemoveFromCounter(Counter& C, size_t Size)
+    {
+      C.Current.fetch_sub(Size, std::memory_order_relaxed);
+      C.Live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    unsigned int Probe(const Stripe& S, unsigned long long Hash)
+    {
+      return (unsigned int)(Hash >> 16) & (S.Capacity - 1);
+    }
+
+    // drops tombstones, grows when the live slots alone would fill it
+    bool Rehash(Stripe& S)
+    {
+      unsigned int Capacity = S.Capacity ? S.Capacity : MIN_CAPACITY;
+      while (S.Live * 2 >= Capacity)
+        Capacity *= 2;
+
+      Slot* Slots = (Slot*)calloc(Capacity, sizeof(Slot));
+      if (!Slots)
+        return false;
+
+      Slot* Old = S.Slots;
+      unsigned int OldCapacity = S.Capacity;
+      S.Slots = Slots;
+      S.Capacity = Capacity;
+      S.Used = S.Live;
+
+      for (unsigned int i = 0; i < OldCapacity; i++)
+      {
+        if (!Old[i].Ptr || Old[i].Ptr == TOMBSTONE)
+          continue;
+        unsigned int Index = Probe(S, HashPointer(Old[i].Ptr));
+        while (S.Slots[Index].Ptr)
+          Index = (Index + 1) & (S.Capacity - 1);
+        S.Slots[Index] = Old[i];
+      }
+      free(Old);
+      return true;
+    }
+
+    void Insert(void* Ptr, size_t Size)
+    {
+      int Tag = CurrentTag;
+      unsigned long long Hash = HashPointer(Ptr);
+      Stripe& S = Stripes[Hash >> (64 - STRIPE_BITS)];
+      {
+        std::lock_guard<SpinLock> Lock(S.Lock);
+        if ((S.Used + 1) * 4 > S.Capacity * 3 && !Rehash(S))
+          return;
+
+        unsigned int Index = Probe(S, Hash);
+        while (S.Slots[Index].Ptr && S.Slots[Index].Ptr != TOMBSTONE)
+          Index = (Index + 1) & (S.Capacity - 1);
+        if (!S.Slots[Index].Ptr)
+          S.Used++;
+        S.Live++;
+        S.Slots[Index].Ptr = Ptr;
+        S.Slots[Index].Size = Size;
+        S.Slots[Index].Tag = Tag;
+      }
+
+      AddToCounter(Tags[Tag], Size);
+      AddToCounter(Total, Size);
+      int Class = SizeClass(Size);
+      ClassAllocations[Class].fetch_add(1, std::memory_order_relaxed);
+      ClassLive[Class].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Remove(void* Ptr)
+    {
+      unsigned long long Hash = HashPointer(Ptr);
+      Stripe& S = Stripes[Hash >> (64 - STRIPE_BITS)];
+      Slot Found;
+      {
+        std::lock_guard<SpinLock> Lock(S.Lock);
+        if (!S.Capacity)
+          return;
+
+        unsigned int Index = Probe(S, Hash);
+        while (S.Slots[Index].Ptr && S.Slots[Index].Ptr != Ptr)
+          Index = (Index + 1) & (S.Capacity - 1);
+        if (!S.Slots[Index].Ptr)
+          return;   // not ours, e.g. freed before tracking started
+
+        Found = S.Slots[Index];
+        S.Slots[Index].Ptr = TOMBSTONE;
+        S.Live--;
+      }
+
+      RemoveFromCounter(Tags[Found.Tag], Found.Size);
+      RemoveFromCounter(Total, Found.Size);
+      ClassLive[SizeClass(Found.Size)].fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    MemoryUsage Read(const Counter& C)
+    {
+      MemoryUsage Usage;
+      Usage.CurrentBytes = C.Current.load(std::memory_order_relaxed);
+      Usage.PeakBytes = C.Peak.load(std::memory_order_relaxed);
+      Usage.Allocations = C.Allocations.load(std::memory_order_relaxed);
+      Usage.LiveAllocations = C.Live.load(std::memory_order_relaxed);
+      return Usage;
+    }
+  }
+
+  MemoryUsage GetMemoryUsage(int Tag)
+  {
+    if (Tag < 0 || Tag >= MEMORY_TAG_COUNT)
+      return Read(Total);
+    return Read(Tags[Tag]);
+  }
+
+  void GetMemorySizeClasses(unsigned long long* Allocations, unsigned long long* LiveAllocations)
+  {
+    for (int c = 0; c < MEMORY_SIZE_CLASSES; c++)
+    {
+      if (Allocations) Allocations[c] = ClassAllocations[c].load(std::memory_order_relaxed);
+      if (LiveAllocations) LiveAllocations[c] = ClassLive[c].load(std::memory_order_relaxed);
+    }
+  }
+
+  void ResetMemoryPeaks()
+  {
+    for (int t = 0; t < MEMORY_TAG_COUNT; t++)
+    {
+      Tags[t].Peak.store(Tags[t].Current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      Tags[t].Allocations.store(0, std::memory_order_relaxed);
+    }
+    Total.Peak.store(Total.Current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    Total.Allocations.store(0, std::memory_order_relaxed);
+    for (int c = 0; c < MEMORY_SIZE_CLASSES; c++)
+      ClassAllocations[c].store(0, std::memory_order_relaxed);
+  }
+
+  void PrintMemoryUsage()
+  {
+    static const char* TagNames[MEMORY_TAG_COUNT] = { "other", "decode", "cube", "blur", "render" };
+
+    print_out("\n%10s : %14s %14s %10s %10s", "tag", "current", "peak", "allocs", "live");
+    for (int t = -1; t < MEMORY_TAG_COUNT; t++)
+    {
+      MemoryUsage Usage = GetMemoryUsage(t);
+      print_out("\n%10s : %14llu %14llu %10llu %10llu", t < 0 ? "total" : TagNames[t],
+        Usage.CurrentBytes, Usage.PeakBytes, Usage.Allocations, Usage.LiveAllocations);
+    }
+
+    unsigned long long Allocations[MEMORY_SIZE_CLASSES], Live[MEMORY_SIZE_CLASSES];
+    GetMemorySizeClasses(Allocations, Live);
+    print_out("\n%10s : %10s %10s", "size >=", "allocs", "live");
+    for (int c = 0; c < MEMORY_SIZE_CLASSES; c++)
+      if (Allocations[c] || Live[c])
+        print_out("\n%10llu : %10llu %10llu", c ? 1ull << c : 0ull, Allocations[c], Live[c]);
+  }
+
+  void TrackAllocation(void* Ptr, size_t Size)
+  {
+    if (Ptr)
+      Insert(Ptr, Size);
+  }
+
+  void UntrackAllocation(void* Ptr)
+  {
+    if (Ptr)
+      Remove(Ptr);
+  }
+
+  int GetMemoryTag() { return CurrentTag; }
+  void SetMemoryTag(int Tag) { CurrentTag = Tag >= 0 && Tag < MEMORY_TAG_COUNT ? Tag : MEMORY_TAG_OTHER; }
+}
+
+#if QUOKKA_MEMORY_TRACKER
+
+static void* TrackedAlloc(std::size_t Size)
+{
+  void* Ptr = malloc(Size ? Size : 1);
+  if (Ptr)
+    quokka::TrackAllocation(Ptr, Size);
+  return Ptr;
+}
+
+static void TrackedFree(void* Ptr)
+{
+  if (!Ptr)
+    return;
+  quokka::UntrackAllocation(Ptr);
+  free(Ptr);
+}
+
+void* operator new(std::size_t Size)
+{
+  void* Ptr = TrackedAlloc(Size);
+  if (!Ptr)
+    throw std::bad_alloc();
+  return Ptr;
+}
+
+void* operator new[](std::size_t Size)
+{
+  void* Ptr = TrackedAlloc(Size);
+  if (!Ptr)
+    throw std::bad_alloc();
+  return Ptr;
+}
+
+void* operator new(std::size_t Size, const std::nothrow_t&) noexcept { return TrackedAlloc(Size); }
+void* operator new[](std::size_t Size, const std::nothrow_t&) noexcept { return TrackedAlloc(Size); }
+
+void operator delete(void* Ptr) noexcept { TrackedFree(Ptr); }
+void operator delete[](void* Ptr) noexcept { TrackedFree(Ptr); }
+void operator delete(void* Ptr, std::size_t) noexcept { TrackedFree(Ptr); }
+void operator delete[](void* Ptr, std::size_t) noexcept { TrackedFree(Ptr); }
+void operator delete(void* Ptr, const std::nothrow_t&) noexcept { TrackedFree(Ptr); }
+void operator delete[](void* Ptr, const std::nothrow_t&) noexcept { TrackedFree(Ptr); }
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+
+// Tracks every allocation made through global new/delete of this library,
+// plus buffers registered by hand with TrackAllocation. Live blocks are kept
+// in a hash split into independently locked stripes, so threads rarely wait
+// on each other. Bytes and counts are kept per size class (power of two) and
+// per subsystem tag, the tag comes from the innermost MemoryTagScope of the
+// allocating thread.
+//
+// Build with QUOKKA_MEMORY_TRACKER=0 to keep the default operators.
+#ifndef QUOKKA_MEMORY_TRACKER
+#define QUOKKA_MEMORY_TRACKER 1
+#endif
+
+namespace quokka
+{
+  enum MemoryTag
+  {
+    MEMORY_TAG_OTHER = 0,
+    MEMORY_TAG_DECODE,
+    MEMORY_TAG_CUBE,
+    MEMORY_TAG_BLUR,
+    MEMORY_TAG_RENDER,
+    MEMORY_TAG_COUNT
+  };
+
+  struct MemoryUsage
+  {
+    unsigned long long CurrentBytes = 0;
+    unsigned long long PeakBytes = 0;
+    unsigned long long Allocations = 0;       // since start or the last ResetMemoryPeaks
+    unsigned long long LiveAllocations = 0;
+  };
+
+  static const int MEMORY_SIZE_CLASSES = 64;
+
+  // Tag -1 is the total over every tag
+  MemoryUsage GetMemoryUsage(int Tag = -1);
+  // class c holds sizes in [2^c, 2^(c+1)), sizes 0 and 1 are class 0
+  void GetMemorySizeClasses(unsigned long long* Allocations, unsigned long long* LiveAllocations);
+  // peaks restart from the current usage, allocation totals from zero
+  void ResetMemoryPeaks();
+  void PrintMemoryUsage();
+
+  // for memory that does not come from new, e.g. _mm_malloc'd buffers
+  void TrackAllocation(void* Ptr, size_t Size);
+  void UntrackAllocation(void* Ptr);
+
+  int GetMemoryTag();
+  void SetMemoryTag(int Tag);
+
+  class MemoryTagScope
+  {
+  public:
+    explicit MemoryTagScope(int Tag) : Previous(GetMemoryTag()) { SetMemoryTag(Tag); }
+    ~MemoryTagScope() { SetMemoryTag(Previous); }
+
+  private:
+    int Previous;
+  };
+}
@@ -0,0 +1,106 @@
+#include "async_job.h"
+#include "worker_pool.h"
+
+#include <chrono>
+
+bool quokka_job::wait(int timeout_ms)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  auto done = [this] { return state.load(std::memory_order_acquire) >= JOB_DONE; };
+  if (timeout_ms < 0)
+  {
+    done_cv.wait(lock, done);
+    return true;
+  }
+  return done_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+}
+
+void quokka_job::release()
+{
+  if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    delete this;
+}
+
+quokka_job* job_queue::push(std::function<bool(progress_token&)> work, job_callback callback, void* user)
+{
+  quokka_job* job = new quokka_job();
+  job->work = std::move(work);
+  job->callback = callback;
+  job->user = user;
+
+  bool start = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(job);
+    start = !running;
+    running = true;
+  }
+
+  // one pool job per busy queue, it keeps going until the queue is empty
+  if (start)
+    global_worker_pool().submit([this] { drain(); });
+  return job;
+}
+
+void job_queue::drain()
+{
+  for (;;)
+  {
+    quokka_job* job;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending.empty())
+      {
+        running = false;
+        idle_cv.notify_all();
+        return;
+      }
+      job = pending.front();
+      pending.pop_front();
+    }
+
+    job_state result = JOB_CANCELLED;
+    if (!job->progress.cancelled())
+    {
+      job->state.store(JOB_RUNNING, std::memory_order_release);
+      // nothing may leave a pool thread, e.g. bad_alloc for a huge cube edge
+      // ends the job as failed
+      try
+      {
+        if (job->work(job->progress))
+          result = JOB_DONE;
+        else if (!job->progress.cancelled())
+          result = JOB_FAILED;
+      }
+      catch (...)
+      {
+        result = JOB_FAILED;
+      }
+    }
+    job->work = nullptr;
+
+    // later jobs build on this one, e.g. a save on the cube of a make_cube
+    if (result != JOB_DONE)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (quokka_job* next : pending)
+        next->cancel();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(job->mutex);
+      job->state.store(result, std::memory_order_release);
+    }
+    job->done_cv.notify_all();
+
+    if (job->callback)
+      job->callback(job, job->user);
+    job->release();
+  }
+}
+
+void job_queue::wait_idle()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  idle_cv.wait(lock, [this] { return !running; });
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "progress.h"
+
+// Long operations handed to the worker pool. Each owner, e.g. a context of
+// the C API, has one job_queue: its jobs run one after another in the order
+// they were pushed, so a host can queue make_cube, blur and save back to
+// back without waiting in between. A job that fails or is cancelled cancels
+// everything queued behind it.
+
+struct quokka_job;
+
+// called on the worker thread right after the job finished. It must not
+// destroy the queue the job came from, that waits for the very thread the
+// callback runs on.
+typedef void (*job_callback)(quokka_job* job, void* user);
+
+// everything from JOB_DONE on means the job has finished
+enum job_state
+{
+  JOB_QUEUED = 0,
+  JOB_RUNNING,
+  JOB_DONE,
+  JOB_CANCELLED,
+  JOB_FAILED
+};
+
+struct quokka_job
+{
+  job_state poll() const { return (job_state)state.load(std::memory_order_acquire); }
+
+  // true once the job has finished, timeout_ms < 0 waits as long as it takes
+  bool wait(int timeout_ms = -1);
+
+  float fraction() const { return progress.fraction(); }
+
+  // a queued job is skipped, a running one stops at its next step
+  void cancel() { progress.cancel(); }
+
+  // drops the caller's reference, the job itself still runs to the end
+  void release();
+
+private:
+  friend struct job_queue;
+
+  std::function<bool(progress_token&)> work;   // false when cancelled or failed
+  progress_token progress;
+  job_callback callback = nullptr;
+  void* user = nullptr;
+
+  std::atomic<int> state{ JOB_QUEUED };
+  std::atomic<int> references{ 2 };   // the caller and the queue
+  std::mutex mutex;
+  std::condition_variable done_cv;
+};
+
+struct job_queue
+{
+  ~job_queue() { wait_idle(); }
+
+  // the caller owns one reference of the returned job and has to release it
+  quokka_job* push(std::function<bool(progress_token&)> work, job_callback callback = nullptr, void* user = nullptr);
+
+  // returns once every pushed job has finished
+  void wait_idle();
+
+private:
+  void drain();
+
+  std::mutex mutex;
+  std::condition_variable idle_cv;
+  std::deque<quokka_job*> pending;
+  bool running = false;
+};
@@ -0,0 +1,377 @@
+// Benchmark runner for the hot paths of the converter. It is its own
+// executable: build it from this file and every library source except
+// main.cpp, which carries the DLL exports and the old test main().
+//
+//   benchmark [--sizes 2k,4k,8k,16k] [--reps N] [--filter text] [--dir path]
+//             [--json out.json] [--compare baseline.json] [--threshold 0.05] [--alpha 0.05]
+//
+// Every size is a synthetic equirect HDR of size x size/2 texels from
+// synthetic_hdr.h, cubes are size/4 texels per edge. Each case runs once to
+// warm up and then --reps times, the table shows median, min, spread and the
+// throughput of the median run.
+//
+// --json stores every repetition together with the machine and build it ran
+// on. --compare runs against such a file and exits with 1 when any case got
+// slower by more than --threshold with a Mann-Whitney p below --alpha, so a
+// CI job can fail on it. Exit code 2 means bad arguments or an unreadable file,
+// this includes --reps too low for --alpha to ever be reached: with 3 runs on
+// each side p can't drop below 0.1, at the default alpha 4 are the minimum.
+
+#include "hdri_cubemap.h"
+#include "benchmark_results.h"
+#include "big_quokka.h"
+#include "synthetic_hdr.h"
+#include "texture.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+static double now_seconds()
+{
+  return quokka::Timer()->GetGlobalTime() * 1e-9;
+}
+
+struct bench_options
+{
+  std::vector<int> sizes = { 2048, 4096 };
+  int reps = 5;
+  std::string filter;
+  std::string dir = ".";
+  std::string json;
+  std::string compare;
+  double threshold = 0.05;
+  double alpha = 0.05;
+};
+
+struct bench_runner
+{
+  bench_options options;
+  std::vector<bench_case> results;
+
+  bool selected(const std::string& name) const
+  {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+  }
+
+  bench_case* run(const std::string& name, int size, const std::function<void()>& body)
+  {
+    if (!selected(name))
+      return nullptr;
+
+    bench_case c;
+    c.name = name;
+    c.size = size;
+    for (int rep = -1; rep < options.reps; rep++)
+    {
+      double start = now_seconds();
+      body();
+      double elapsed = now_seconds() - start;
+      if (rep >= 0)
+        c.seconds.push_back(elapsed);
+    }
+
+    results.push_back(c);
+    return &results.back();
+  }
+
+  static void print_header()
+  {
+    printf("%-26s %6s %11s %11s %7s  %s\n", "case", "size", "median ms", "min ms", "cv %", "throughput");
+  }
+
+  // called once the case knows how much work one repetition did
+  static void report(const bench_case* c)
+  {
+    if (!c)
+      return;
+
+    bench_stats s = compute_stats(c->seconds);
+    printf("%-26s %6d %11.3f %11.3f %7.2f ", c->name.c_str(), c->size, s.median * 1e3, s.min * 1e3,
+      s.mean > 0 ? 100.0 * s.stddev / s.mean : 0.0);
+    if (s.median > 0)
+    {
+      if (c->bytes > 0) printf(" %9.1f MB/s", c->bytes / s.median / (1024.0 * 1024.0));
+      if (c->texels > 0) printf(" %9.1f Mtexel/s", c->texels / s.median * 1e-6);
+      if (c->frames > 0) printf(" %9.1f frames/s", c->frames / s.median);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+};
+
+static long file_size(const std::string& filename)
+{
+  FILE* f;
+  if (fopen_s(&f, filename.c_str(), "rb") != 0 || !f)
+    return 0;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+static void bench_size(bench_runner& runner, int width)
+{
+  int height = width / 2;
+  int edge = width / 4;
+  double source_texels = double(width) * height;
+  double cube_texels = 6.0 * edge * edge;
+
+  std::string hdr_path = runner.options.dir + "/bench_source.hdr";
+  std::string dds_path = runner.options.dir + "/bench_cube.dds";
+
+  std::vector<float> rgb((size_t)width * height * 3);
+  make_synthetic_hdr(rgb.data(), width, height, 1);
+
+  bench_case* c = runner.run("rgbe_write_rle", width, [&]
+  {
+    FILE* f;
+    if (fopen_s(&f, hdr_path.c_str(), "wb") != 0 || !f)
+      return;
+    RGBE_WriteHeader(f, width, height, NULL);
+    RGBE_WritePixels_RLE(f, rgb.data(), width, height);
+    fclose(f);
+  });
+  if (c)
+  {
+    c->bytes = (double)file_size(hdr_path);
+    c->texels = source_texels;
+  }
+  bench_runner::report(c);
+
+  // the read case needs the file even when the write case is filtered out
+  if (file_size(hdr_path) == 0)
+    write_synthetic_hdr(hdr_path.c_str(), width, height, 1);
+
+  c = runner.run("rgbe_read_rle", width, [&]
+  {
+    FILE* f;
+    if (fopen_s(&f, hdr_path.c_str(), "rb") != 0 || !f)
+      return;
+    int w = 0, h = 0;
+    RGBE_ReadHeader(f, &w, &h, NULL);
+    RGBE_ReadPixels_RLE(f, rgb.data(), w, h);
+    fclose(f);
+  });
+  if (c)
+  {
+    c->bytes = (double)file_size(hdr_path);
+    c->texels = source_texels;
+  }
+  bench_runner::report(c);
+
+  std::vector<pixel> source((size_t)width * height);
+  for (size_t i = 0; i < source.size(); i++)
+    source[i] = pixel(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+  std::vector<float>().swap(rgb);
+
+  SCube cube;
+  c = runner.run("make_cube", width, [&]
+  {
+    cube.make_cube(source.data(), width, height, edge, 0.f);
+  });
+  if (c) c->texels = cube_texels;
+  bench_runner::report(c);
+
+  if (!cube.edges[0])
+    cube.make_cube(source.data(), width, height, edge, 0.f);
+
+  const int blur_powers[] = { 1, 4, 16 };
+  for (int power : blur_powers)
+  {
+    c = runner.run("blur_" + std::to_string(power), width, [&]
+    {
+      cube.blur(power);
+    });
+    if (c) c->texels = cube_texels * power;
+    bench_runner::report(c);
+  }
+
+  pixel* strip = nullptr;
+  c = runner.run("get_unreal_cubemap", width, [&]
+  {
+    delete[] strip;
+    strip = cube.get_unreal_cubemap();
+  });
+  if (c)
+  {
+    c->texels = cube_texels;
+    c->bytes = cube_texels * sizeof(pixel);
+  }
+  bench_runner::report(c);
+
+  c = runner.run("write_dds_cubemap", width, [&]
+  {
+    write_dds_cubemap(dds_path.c_str(), cube.blurred_edges, edge);
+  });
+  if (c)
+  {
+    c->bytes = (double)file_size(dds_path);
+    c->texels = cube_texels;
+  }
+  bench_runner::report(c);
+
+  // preview of this cube, as prepare_preview sets it up
+  if (runner.selected("draw_triangular_model"))
+  {
+    if (!strip)
+      strip = cube.get_unreal_cubemap();
+
+    mip_texture texture;
+    texture.build(strip, edge, 6);
+
+    model sphere;
+    sphere.from_sky_sphere(false);
+    sphere.diffuse = strip;
+    sphere.d_width = edge * 6;
+    sphere.d_height = edge;
+    sphere.texture = &texture;
+
+    renderer r;
+    r.resize(1024, 1024);
+
+    const int frames = 16;
+    c = runner.run("draw_triangular_model", width, [&]
+    {
+      for (int f = 0; f < frames; f++)
+      {
+        sphere.set_rotation(f * 7.5f);
+        r.clear();
+        r.clear_z();
+        r.draw_triangular_model(sphere);
+      }
+    });
+    if (c) c->frames = frames;
+    bench_runner::report(c);
+  }
+
+  delete[] strip;
+  remove(hdr_path.c_str());
+  remove(dds_path.c_str());
+}
+
+// "2k", "4096" and so on
+static int parse_size(const std::string& text)
+{
+  int value = atoi(text.c_str());
+  if (!text.empty() && (text.back() == 'k' || text.back() == 'K'))
+    value *= 1024;
+  return value;
+}
+
+static bool parse_options(int argc, char** argv, bench_options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--sizes" && has_value)
+    {
+      options.sizes.clear();
+      std::string list = argv[++i];
+      size_t start = 0;
+      while (start <= list.size())
+      {
+        size_t comma = list.find(',', start);
+        if (comma == std::string::npos)
+          comma = list.size();
+        int size = parse_size(list.substr(start, comma - start));
+        if (size >= 64)
+          options.sizes.push_back(size & ~63);
+        start = comma + 1;
+      }
+    }
+    else if (arg == "--reps" && has_value)
+      options.reps = std::max(1, atoi(argv[++i]));
+    else if (arg == "--filter" && has_value)
+      options.filter = argv[++i];
+    else if (arg == "--dir" && has_value)
+      options.dir = argv[++i];
+    else if (arg == "--json" && has_value)
+      options.json = argv[++i];
+    else if (arg == "--compare" && has_value)
+      options.compare = argv[++i];
+    else if (arg == "--threshold" && has_value)
+      options.threshold = atof(argv[++i]);
+    else if (arg == "--alpha" && has_value)
+      options.alpha = atof(argv[++i]);
+    else
+    {
+      printf("usage: benchmark [--sizes 2k,4k,8k,16k] [--reps N] [--filter text] [--dir path]\n"
+        "                 [--json out.json] [--compare baseline.json] [--threshold 0.05] [--alpha 0.05]\n");
+      return false;
+    }
+  }
+  return !options.sizes.empty();
+}
+
+int main(int argc, char** argv)
+{
+  bench_runner runner;
+  if (!parse_options(argc, argv, runner.options))
+    return 2;
+
+  // read the baseline first so a bad path fails before the long run
+  bench_environment baseline_env;
+  std::vector<bench_case> baseline;
+  if (!runner.options.compare.empty() && !read_bench_json(runner.options.compare.c_str(), baseline_env, baseline))
+  {
+    printf("can't read baseline %s\n", runner.options.compare.c_str());
+    return 2;
+  }
+
+  if (!runner.options.compare.empty())
+  {
+    // the fewest runs any baseline case has bounds what the test can show
+    int baseline_reps = 0;
+    for (const bench_case& c : baseline)
+      if (!c.seconds.empty() && (baseline_reps == 0 || (int)c.seconds.size() < baseline_reps))
+        baseline_reps = (int)c.seconds.size();
+
+    double min_p = mann_whitney_min_p(baseline_reps, runner.options.reps);
+    if (min_p >= runner.options.alpha)
+    {
+      int needed = 1;
+      while (needed < 64 && mann_whitney_min_p(baseline_reps, needed) >= runner.options.alpha)
+        needed++;
+      printf("--compare with %d baseline runs and --reps %d can't get p below %.4f, alpha is %g\n",
+        baseline_reps, runner.options.reps, min_p, runner.options.alpha);
+      if (needed < 64)
+        printf("use --reps %d or more\n", needed);
+      else
+        printf("the baseline needs more runs\n");
+      return 2;
+    }
+  }
+
+  bench_environment env = bench_environment::current();
+  printf("cpu: %s, %d hardware threads, %d workers\n", env.cpu.c_str(), env.hardware_threads, env.worker_threads);
+  printf("build: %s, %s\n\n", env.compiler.c_str(), env.build_flags.c_str());
+
+  bench_runner::print_header();
+  for (int size : runner.options.sizes)
+    bench_size(runner, size);
+
+  if (!runner.options.json.empty() && !write_bench_json(runner.options.json.c_str(), env, runner.results))
+  {
+    printf("can't write %s\n", runner.options.json.c_str());
+    return 2;
+  }
+
+  if (runner.options.compare.empty())
+    return 0;
+
+  printf("\nbaseline: %s, %s, %s\n", baseline_env.cpu.c_str(), baseline_env.compiler.c_str(), baseline_env.build_flags.c_str());
+  if (baseline_env.cpu != env.cpu || baseline_env.build_flags != env.build_flags)
+    printf("warning: baseline comes from another machine or build\n");
+  printf("\n");
+
+  int regressions = compare_bench(baseline, runner.results, runner.options.threshold, runner.options.alpha);
+  printf("\n%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+  return regressions ? 1 : 0;
+}
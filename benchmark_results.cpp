@@ -0,0 +1,462 @@
+#include "benchmark_results.h"
+#include "big_quokka.h"
+#include "MemoryTracker.h"
+#include "sky_sphere.h"
+#include "worker_pool.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#define BENCH_HAS_CPUID 1
+#endif
+
+bench_stats compute_stats(std::vector<double> samples)
+{
+  bench_stats s;
+  if (samples.empty())
+    return s;
+
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  s.min = samples.front();
+  s.max = samples.back();
+  s.median = n % 2 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+
+  for (double v : samples)
+    s.mean += v;
+  s.mean /= n;
+  for (double v : samples)
+    s.stddev += (v - s.mean) * (v - s.mean);
+  s.stddev = n > 1 ? sqrt(s.stddev / (n - 1)) : 0.0;
+  return s;
+}
+
+static std::string cpu_brand()
+{
+#ifdef BENCH_HAS_CPUID
+  unsigned int regs[12] = {};
+  for (unsigned int i = 0; i < 3; i++)
+  {
+#ifdef _MSC_VER
+    int out[4];
+    __cpuid(out, (int)(0x80000002u + i));
+    for (int k = 0; k < 4; k++) regs[i * 4 + k] = (unsigned int)out[k];
+#else
+    if (!__get_cpuid(0x80000002u + i, &regs[i * 4], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]))
+      return "unknown";
+#endif
+  }
+
+  std::string brand((const char*)regs, sizeof(regs));
+  brand = brand.substr(0, brand.find('\0'));
+  size_t first = brand.find_first_not_of(' ');
+  return first == std::string::npos ? "unknown" : brand.substr(first);
+#else
+  return "unknown";
+#endif
+}
+
+bench_environment bench_environment::current()
+{
+  bench_environment env;
+  env.cpu = cpu_brand();
+  env.hardware_threads = (int)std::thread::hardware_concurrency();
+  env.worker_threads = global_worker_pool().size();
+  env.timestamp = (long long)time(nullptr);
+
+  char text[64];
+#if defined(__clang__)
+  sprintf_s(text, "clang %d.%d.%d", __clang_major__, __clang_minor__, __clang_patchlevel__);
+#elif defined(_MSC_VER)
+  sprintf_s(text, "msvc %d", _MSC_FULL_VER);
+#elif defined(__GNUC__)
+  sprintf_s(text, "gcc %d.%d.%d", __GNUC__, __GNUC_MINOR__, __GNUC_PATCHLEVEL__);
+#else
+  sprintf_s(text, "unknown");
+#endif
+  env.compiler = text;
+
+  std::string flags;
+#ifdef NDEBUG
+  flags += "NDEBUG ";
+#endif
+#ifdef _DEBUG
+  flags += "_DEBUG ";
+#endif
+#if defined(__AVX2__)
+  flags += "AVX2 ";
+#elif defined(__AVX__)
+  flags += "AVX ";
+#elif defined(__SSE4_1__)
+  flags += "SSE4.1 ";
+#endif
+#ifdef QUOKKA_PROFILER
+  flags += "QUOKKA_PROFILER=" + std::to_string(QUOKKA_PROFILER) + " ";
+#endif
+#ifdef QUOKKA_MEMORY_TRACKER
+  flags += "QUOKKA_MEMORY_TRACKER=" + std::to_string(QUOKKA_MEMORY_TRACKER) + " ";
+#endif
+  flags += "SKY_SPHERE_TESSELLATION=" + std::to_string(SKY_SPHERE_TESSELLATION) + " ";
+  flags += std::to_string(sizeof(void*) * 8) + "bit";
+  env.build_flags = flags;
+  return env;
+}
+
+static std::string json_escape(const std::string& text)
+{
+  std::string out;
+  for (char c : text)
+  {
+    if (c == '"' || c == '\\') { out += '\\'; out += c; }
+    else if ((unsigned char)c < 0x20) out += ' ';
+    else out += c;
+  }
+  return out;
+}
+
+bool write_bench_json(const char* filename, const bench_environment& env, const std::vector<bench_case>& cases)
+{
+  FILE* f;
+  if (fopen_s(&f, filename, "w") != 0 || !f)
+    return false;
+
+  fprintf(f, "{\n  \"environment\": {\n");
+  fprintf(f, "    \"cpu\": \"%s\",\n", json_escape(env.cpu).c_str());
+  fprintf(f, "    \"hardware_threads\": %d,\n", env.hardware_threads);
+  fprintf(f, "    \"worker_threads\": %d,\n", env.worker_threads);
+  fprintf(f, "    \"compiler\": \"%s\",\n", json_escape(env.compiler).c_str());
+  fprintf(f, "    \"build_flags\": \"%s\",\n", json_escape(env.build_flags).c_str());
+  fprintf(f, "    \"timestamp\": %lld\n  },\n", env.timestamp);
+
+  fprintf(f, "  \"cases\": [");
+  for (size_t i = 0; i < cases.size(); i++)
+  {
+    const bench_case& c = cases[i];
+    bench_stats s = compute_stats(c.seconds);
+    fprintf(f, "%s\n    {\"name\": \"%s\", \"size\": %d, \"bytes\": %.0f, \"texels\": %.0f, \"frames\": %.0f,",
+      i ? "," : "", json_escape(c.name).c_str(), c.size, c.bytes, c.texels, c.frames);
+    fprintf(f, " \"median\": %.9g, \"mean\": %.9g, \"stddev\": %.9g, \"seconds\": [", s.median, s.mean, s.stddev);
+    for (size_t k = 0; k < c.seconds.size(); k++)
+      fprintf(f, "%s%.9g", k ? ", " : "", c.seconds[k]);
+    fprintf(f, "]}");
+  }
+  fprintf(f, "\n  ]\n}\n");
+
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
+
+// Just enough JSON for files write_bench_json produced: objects, arrays,
+// strings without unicode escapes, numbers and literals.
+namespace
+{
+  struct json_value
+  {
+    enum kind_t { NUL, NUMBER, STRING, ARRAY, OBJECT, BOOLEAN } kind = NUL;
+    double number = 0;
+    std::string text;
+    std::vector<json_value> items;
+    std::map<std::string, json_value> fields;
+
+    const json_value* get(const char* key) const
+    {
+      std::map<std::string, json_value>::const_iterator it = fields.find(key);
+      return it == fields.end() ? nullptr : &it->second;
+    }
+  };
+
+  struct json_parser
+  {
+    const char* p;
+    const char* end;
+
+    void skip()
+    {
+      while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    }
+
+    bool parse_string(std::string& out)
+    {
+      if (p >= end || *p != '"')
+        return false;
+      p++;
+      while (p < end && *p != '"')
+      {
+        if (*p == '\\' && p + 1 < end)
+          p++;
+        out += *p++;
+      }
+      if (p >= end)
+        return false;
+      p++;
+      return true;
+    }
+
+    bool parse(json_value& v)
+    {
+      skip();
+      if (p >= end)
+        return false;
+
+      if (*p == '{')
+      {
+        v.kind = json_value::OBJECT;
+        p++;
+        skip();
+        if (p < end && *p == '}') { p++; return true; }
+        for (;;)
+        {
+          skip();
+          std::string key;
+          if (!parse_string(key))
+            return false;
+          skip();
+          if (p >= end || *p != ':')
+            return false;
+          p++;
+          if (!parse(v.fields[key]))
+            return false;
+          skip();
+          if (p < end && *p == ',') { p++; continue; }
+          if (p < end && *p == '}') { p++; return true; }
+          return false;
+        }
+      }
+      if (*p == '[')
+      {
+        v.kind = json_value::ARRAY;
+        p++;
+        skip();
+        if (p < end && *p == ']') { p++; return true; }
+        for (;;)
+        {
+          v.items.push_back(json_value());
+          if (!parse(v.items.back()))
+            return false;
+          skip();
+          if (p < end && *p == ',') { p++; continue; }
+          if (p < end && *p == ']') { p++; return true; }
+          return false;
+        }
+      }
+      if (*p == '"')
+      {
+        v.kind = json_value::STRING;
+        return parse_string(v.text);
+      }
+      if (end - p >= 4 && !strncmp(p, "null", 4)) { p += 4; return true; }
+      if (end - p >= 4 && !strncmp(p, "true", 4)) { v.kind = json_value::BOOLEAN; v.number = 1; p += 4; return true; }
+      if (end - p >= 5 && !strncmp(p, "false", 5)) { v.kind = json_value::BOOLEAN; p += 5; return true; }
+
+      char* number_end = nullptr;
+      v.number = strtod(p, &number_end);
+      if (number_end == p)
+        return false;
+      v.kind = json_value::NUMBER;
+      p = number_end;
+      return true;
+    }
+  };
+
+  std::string text_of(const json_value& object, const char* key)
+  {
+    const json_value* v = object.get(key);
+    return v && v->kind == json_value::STRING ? v->text : std::string();
+  }
+
+  double number_of(const json_value& object, const char* key)
+  {
+    const json_value* v = object.get(key);
+    return v && v->kind == json_value::NUMBER ? v->number : 0.0;
+  }
+}
+
+bool read_bench_json(const char* filename, bench_environment& env, std::vector<bench_case>& cases)
+{
+  FILE* f;
+  if (fopen_s(&f, filename, "rb") != 0 || !f)
+    return false;
+  std::string data;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    data.append(buffer, n);
+  fclose(f);
+
+  json_value root;
+  json_parser parser = { data.data(), data.data() + data.size() };
+  if (!parser.parse(root) || root.kind != json_value::OBJECT)
+    return false;
+
+  if (const json_value* e = root.get("environment"))
+  {
+    env.cpu = text_of(*e, "cpu");
+    env.hardware_threads = (int)number_of(*e, "hardware_threads");
+    env.worker_threads = (int)number_of(*e, "worker_threads");
+    env.compiler = text_of(*e, "compiler");
+    env.build_flags = text_of(*e, "build_flags");
+    env.timestamp = (long long)number_of(*e, "timestamp");
+  }
+
+  const json_value* list = root.get("cases");
+  if (!list || list->kind != json_value::ARRAY)
+    return false;
+
+  cases.clear();
+  for (const json_value& item : list->items)
+  {
+    bench_case c;
+    c.name = text_of(item, "name");
+    c.size = (int)number_of(item, "size");
+    c.bytes = number_of(item, "bytes");
+    c.texels = number_of(item, "texels");
+    c.frames = number_of(item, "frames");
+    if (const json_value* seconds = item.get("seconds"))
+      for (const json_value& s : seconds->items)
+        c.seconds.push_back(s.number);
+    cases.push_back(c);
+  }
+  return true;
+}
+
+double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b)
+{
+  int n1 = (int)a.size(), n2 = (int)b.size();
+  if (n1 == 0 || n2 == 0)
+    return 1.0;
+
+  // average ranks over the pooled samples
+  std::vector<std::pair<double, int>> pooled;
+  for (double v : a) pooled.push_back(std::make_pair(v, 0));
+  for (double v : b) pooled.push_back(std::make_pair(v, 1));
+  std::sort(pooled.begin(), pooled.end());
+
+  int n = n1 + n2;
+  double rank_sum_a = 0, tie_term = 0;
+  bool ties = false;
+  for (int i = 0; i < n;)
+  {
+    int j = i;
+    while (j < n && pooled[j].first == pooled[i].first)
+      j++;
+    double rank = 0.5 * (i + 1 + j);
+    for (int k = i; k < j; k++)
+      if (pooled[k].second == 0)
+        rank_sum_a += rank;
+    double t = j - i;
+    tie_term += t * t * t - t;
+    ties |= j - i > 1;
+    i = j;
+  }
+  double u = rank_sum_a - n1 * (n1 + 1) / 2.0;
+
+  if (!ties && n1 <= 20 && n2 <= 20)
+  {
+    // ways[u] over all rankings of n1 + n2 items, built up one item at a time
+    std::vector<std::vector<std::vector<double>>> ways(n1 + 1, std::vector<std::vector<double>>(n2 + 1));
+    for (int i = 0; i <= n1; i++)
+    {
+      for (int j = 0; j <= n2; j++)
+      {
+        std::vector<double>& w = ways[i][j];
+        w.assign(i * j + 1, 0.0);
+        if (i == 0 || j == 0)
+        {
+          w[0] = 1.0;
+          continue;
+        }
+        // the largest item belongs to a (beats all j of b) or to b
+        const std::vector<double>& with_a = ways[i - 1][j];
+        const std::vector<double>& with_b = ways[i][j - 1];
+        for (int k = 0; k <= i * j; k++)
+        {
+          if (k - j >= 0 && k - j < (int)with_a.size()) w[k] += with_a[k - j];
+          if (k < (int)with_b.size()) w[k] += with_b[k];
+        }
+      }
+    }
+
+    const std::vector<double>& dist = ways[n1][n2];
+    double total = 0, below = 0, above = 0;
+    int observed = (int)(u + 0.5);
+    for (int k = 0; k < (int)dist.size(); k++)
+    {
+      total += dist[k];
+      if (k <= observed) below += dist[k];
+      if (k >= observed) above += dist[k];
+    }
+    return std::min(1.0, 2.0 * std::min(below, above) / total);
+  }
+
+  double mean = n1 * n2 / 2.0;
+  double variance = n1 * n2 / 12.0 * ((n + 1) - tie_term / (double(n) * (n - 1)));
+  if (variance <= 0)
+    return 1.0;
+  double z = (fabs(u - mean) - 0.5) / sqrt(variance);
+  if (z < 0)
+    z = 0;
+  return erfc(z / sqrt(2.0));
+}
+
+double mann_whitney_min_p(int n1, int n2)
+{
+  if (n1 <= 0 || n2 <= 0)
+    return 1.0;
+  // 2 / C(n1 + n2, n1)
+  double ways = 1.0;
+  for (int k = 1; k <= n1; k++)
+    ways = ways * (n2 + k) / k;
+  return std::min(1.0, 2.0 / ways);
+}
+
+int compare_bench(const std::vector<bench_case>& baseline, const std::vector<bench_case>& current,
+  double threshold, double alpha)
+{
+  printf("%-26s %6s %11s %11s %9s %8s  %s\n", "case", "size", "base ms", "now ms", "change", "p", "verdict");
+
+  int regressions = 0;
+  for (const bench_case& now : current)
+  {
+    const bench_case* base = nullptr;
+    for (const bench_case& b : baseline)
+      if (b.name == now.name && b.size == now.size)
+        base = &b;
+    if (!base || base->seconds.empty() || now.seconds.empty())
+      continue;
+
+    double base_median = compute_stats(base->seconds).median;
+    double now_median = compute_stats(now.seconds).median;
+    double change = base_median > 0 ? now_median / base_median - 1.0 : 0.0;
+    double p = mann_whitney_p(base->seconds, now.seconds);
+    bool significant = p < alpha;
+
+    const char* verdict = "same";
+    if (significant && change > threshold)
+    {
+      verdict = "REGRESSION";
+      regressions++;
+    }
+    else if (significant && change < -threshold)
+      verdict = "faster";
+    else if (fabs(change) > threshold)
+      verdict = "noise";
+
+    printf("%-26s %6d %11.3f %11.3f %+8.1f%% %8.4f  %s\n", now.name.c_str(), now.size,
+      base_median * 1e3, now_median * 1e3, change * 100.0, p, verdict);
+  }
+  return regressions;
+}
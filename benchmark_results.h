@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Results of one benchmark run, their JSON form and the comparison against
+// a stored baseline. Used by benchmark.cpp only.
+
+struct bench_case
+{
+  std::string name;
+  int size = 0;                   // width of the source equirect
+  std::vector<double> seconds;    // one entry per repetition
+
+  // work done by one repetition, zero when it does not apply
+  double bytes = 0;
+  double texels = 0;
+  double frames = 0;
+};
+
+struct bench_stats
+{
+  double median = 0, mean = 0, min = 0, max = 0, stddev = 0;
+};
+
+bench_stats compute_stats(std::vector<double> samples);
+
+// where a run happened, stored with the results so a baseline from another
+// machine or build is easy to spot
+struct bench_environment
+{
+  std::string cpu;
+  int hardware_threads = 0;
+  int worker_threads = 0;
+  std::string compiler;
+  std::string build_flags;
+  long long timestamp = 0;
+
+  static bench_environment current();
+};
+
+bool write_bench_json(const char* filename, const bench_environment& env, const std::vector<bench_case>& cases);
+bool read_bench_json(const char* filename, bench_environment& env, std::vector<bench_case>& cases);
+
+// two-sided p-value of the Mann-Whitney U test, exact for small samples
+// without ties, normal approximation with tie correction otherwise
+double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b);
+
+// the smallest p the exact test can give for samples of n1 and n2, reached
+// when they don't overlap at all. Below alpha no comparison can ever be
+// significant, e.g. 3 against 3 never gets under 0.1.
+double mann_whitney_min_p(int n1, int n2);
+
+// a case is a regression when its median is more than threshold (0.05 is
+// 5%) slower than the baseline and the difference is significant at alpha.
+// Prints one line per case found in both, returns the regression count.
+int compare_bench(const std::vector<bench_case>& baseline, const std::vector<bench_case>& current,
+  double threshold, double alpha);
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cassert>
 #include <chrono>
 #include <iostream>
 #include <string>
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <vector>
 
 #include "print.h"
 
@@ -28,8 +32,25 @@ namespace quokka
   };
 }
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define QUOKKA_HAS_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#define QUOKKA_HAS_TSC 0
+#endif
+
 namespace quokka
 {
+  typedef unsigned long long uint64;
+  typedef unsigned long uint32;
+
+  // GetGlobalTime is in nanoseconds since the timer was created or, for the
+  // HighResolutionTimer, since its first reading,
+  // GetFrameTime in microseconds
   class Timer
   {
   public:
@@ -43,9 +64,10 @@ namespace quokka
   public:
 
     typedef std::chrono::nanoseconds Duration;
+    typedef std::chrono::steady_clock Clock;
 
     STDChronoTimer()
-      :Last(std::chrono::high_resolution_clock::now())
+      :Last(Clock::now())
       , Start(Last)
     {}
     virtual ~STDChronoTimer(){}
@@ -53,7 +75,7 @@ namespace quokka
     // Call only once per frame!
     virtual void CalculateFrameTime()
     {
-      std::chrono::high_resolution_clock::time_point Now = std::chrono::high_resolution_clock::now();
+      Clock::time_point Now = Clock::now();
       LastFrameDuration = std::chrono::duration_cast<Duration>(Now - Last).count();
       Last = Now;
     }
@@ -62,43 +84,48 @@ namespace quokka
 
     virtual long long GetGlobalTime()
     {
-      std::chrono::high_resolution_clock::time_point Now = std::chrono::high_resolution_clock::now();
+      Clock::time_point Now = Clock::now();
       return std::chrono::duration_cast<Duration>(Now - Start).count();
     }
 
   private:
-    long long LastFrameDuration;
-    std::chrono::high_resolution_clock::time_point Last;
-    std::chrono::high_resolution_clock::time_point Start;
+    long long LastFrameDuration = 0;
+    Clock::time_point Last;
+    Clock::time_point Start;
   };
 
-  STDChronoTimer* STDChronoTimer::Instance = NULL;
-
-  typedef unsigned long long uint64;
-  typedef unsigned long uint32;
-  
+  // Reads the 64-bit TSC when the CPU reports an invariant one and converts
+  // ticks to nanoseconds with a ratio calibrated against the monotonic clock.
+  // Anything else reads std::chrono::steady_clock. The instance is created by
+  // a static initializer, which runs inside DllMain, so the calibration spin
+  // waits for the first timestamp instead.
   class HighResolutionTimer : public Timer, public Singletone<HighResolutionTimer>
   {
   public:
     
-    HighResolutionTimer()
-      :Last(rdtsc())
-      , Start(Last)
-    {}
+    HighResolutionTimer();
     virtual ~HighResolutionTimer(){}
 
+    // rdtscp waits for earlier instructions, without it lfence does the same
     uint64 rdtsc()
     {
-      uint32 cur_time;
-      __asm rdtsc;
-      __asm mov [cur_time], eax;
-      return cur_time;
+#if QUOKKA_HAS_TSC
+      if (HasRdtscp)
+      {
+        unsigned int Aux;
+        return __rdtscp(&Aux);
+      }
+      _mm_lfence();
+      return __rdtsc();
+#else
+      return 0;
+#endif
     }
 
     // Call only once per frame!
     virtual void CalculateFrameTime()
     {
-      uint64 Now = rdtsc();
+      long long Now = GetGlobalTime();
       LastFrameDuration = Now - Last;
       Last = Now;
     }
@@ -107,60 +134,409 @@ namespace quokka
 
     virtual long long GetGlobalTime()
     {
-      uint64 Now = rdtsc();
-      return Now - Start;
+      if (!Calibrated.load(std::memory_order_acquire))
+        CalibrateOnce();
+      if (!UseTsc)
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ChronoStart).count();
+      return (long long)((rdtsc() - Start) * NanosecondsPerTick);
     }
 
+    bool IsTscBased() { GetGlobalTime(); return UseTsc; }
+    double GetNanosecondsPerTick() { GetGlobalTime(); return NanosecondsPerTick; }
+
   private:
-    uint64 LastFrameDuration;
-    uint64 Last;
-    uint64 Start;
+    void CalibrateOnce();
+    void Calibrate();
+
+    std::once_flag CalibrationFlag;
+    std::atomic<bool> Calibrated{ false };
+
+    bool UseTsc = false;
+    bool HasRdtscp = false;
+    double NanosecondsPerTick = 1.0;
+    std::chrono::steady_clock::time_point ChronoStart = std::chrono::steady_clock::now();
+
+    long long LastFrameDuration = 0;
+    long long Last = 0;
+    uint64 Start = 0;
   };
 
-  HighResolutionTimer* HighResolutionTimer::Instance = NULL;
   static Timer* Timer() { return HighResolutionTimer::GetInstance(); }
 }
 
+// Profiler scopes are interned once per call site, QUOKKA_PROFILE_SCOPE keeps
+// the id in a function-local static so a scope costs two clock reads and an
+// array access. Build with QUOKKA_PROFILER=0 to compile the scopes out.
+//
+// Every thread records into its own buffer, registered on first use in a
+// lock-free list, so scopes never contend. Only the owning thread writes its
+// counters, reports read them with relaxed loads and merge across threads.
+//
+// Scopes must nest. Each thread keeps a stack of open scopes and a call tree
+// keyed by (parent node, scope), so reports show inclusive and self time per
+// call path, and every scope feeds a log-bucketed latency histogram.
+//
+// With hardware counters on (Linux perf_event_open only) every scope also
+// reads cycles, instructions, LLC misses and branch misses at entry and exit
+// and adds the inclusive delta to the scope. Threads that cannot open the
+// counters, e.g. for lack of permission, keep timing only.
+//
+// With tracing on every scope also appends a begin/duration event to its
+// thread's trace chunks, WriteChromeTrace dumps them for chrome://tracing or
+// Perfetto. Global time is in nanoseconds.
+#ifndef QUOKKA_PROFILER
+#define QUOKKA_PROFILER 1
+#endif
+
 namespace quokka
 {
+  typedef int ProfilerScopeId;
+
+  inline int HighestBit(uint64 Value)
+  {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long Index;
+    _BitScanReverse64(&Index, Value);
+    return (int)Index;
+#elif defined(__GNUC__)
+    return 63 - __builtin_clzll(Value);
+#else
+    int Index = 0;
+    while (Value >>= 1) Index++;
+    return Index;
+#endif
+  }
+
+  // HdrHistogram-style buckets: exact below 8, above that 8 linear steps per
+  // power of two, so a bucket is never wider than 12.5% of its value
+  struct ProfilerHistogram
+  {
+    static const int SUB_BITS = 3;
+    static const int SUB = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    std::atomic<uint64> Counts[BUCKETS];
+
+    ProfilerHistogram()
+    {
+      for (int i = 0; i < BUCKETS; i++)
+        Counts[i].store(0, std::memory_order_relaxed);
+    }
+
+    static int Bucket(uint64 Value)
+    {
+      if (Value < SUB)
+        return (int)Value;
+      int Exponent = HighestBit(Value);
+      return (Exponent - SUB_BITS + 1) * SUB + (int)((Value >> (Exponent - SUB_BITS)) & (SUB - 1));
+    }
+
+    static uint64 BucketLow(int Index)
+    {
+      if (Index < SUB)
+        return (uint64)Index;
+      int Exponent = Index / SUB + SUB_BITS - 1;
+      return (uint64)(SUB + Index % SUB) << (Exponent - SUB_BITS);
+    }
+  };
+
+  enum ProfilerCounter
+  {
+    COUNTER_CYCLES = 0,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+  };
+
   struct ProfilerStamp
-  {    
-    uint64 Start = 0;
-    uint64 Stop = 0;
+  {
+    std::atomic<uint64> Sum{ 0 };
+    std::atomic<uint64> Count{ 0 };
+    std::atomic<uint64> Min{ ~0ull };
+    std::atomic<uint64> Max{ 0 };
+    std::atomic<ProfilerHistogram*> Histogram{ nullptr };
+    std::atomic<uint64> Counters[COUNTER_COUNT] = {};
+
+    // last call tree lookup, owner thread only
+    int CachedParent = -2;
+    int CachedNode = -1;
+  };
+
+  // one call path, Parent and Id are written before the node is published
+  struct ProfilerNode
+  {
+    ProfilerScopeId Id = 0;
+    int Parent = -1;
+    int FirstChild = -1;
+    int NextSibling = -1;
+    std::atomic<uint64> Sum{ 0 };
+    std::atomic<uint64> ChildSum{ 0 };
+    std::atomic<uint64> Count{ 0 };
+  };
+
+  struct TraceEvent
+  {
+    uint64 Begin;
+    uint64 End;
+    ProfilerScopeId Id;
+    int Depth;
+  };
+
+  // events are published by bumping Count after they are written, so a
+  // reader only sees complete ones
+  struct TraceChunk
+  {
+    static const int SIZE = 4096;
+    TraceEvent Events[SIZE];
+    std::atomic<int> Count{ 0 };
+    std::atomic<TraceChunk*> Next{ nullptr };
+  };
+
+  // per scope result of a report, for one thread or merged over all of them,
+  // percentiles are bucket midpoints
+  struct ProfilerTotal
+  {
+    const char* Name = nullptr;
     uint64 Sum = 0;
+    uint64 Count = 0;
+    uint64 Min = 0;
+    uint64 Max = 0;
+    uint64 P50 = 0;
+    uint64 P90 = 0;
+    uint64 P99 = 0;
+    uint64 Counters[COUNTER_COUNT] = {};
+    bool HasCounters = false;
+  };
+
+  // call tree report in depth-first order, Parent indexes the same vector
+  struct ProfilerTreeNode
+  {
+    const char* Name = nullptr;
+    int Parent = -1;
+    int Depth = 0;
+    uint64 Sum = 0;
+    uint64 Self = 0;
+    uint64 Count = 0;
   };
 
   class Profiler : public Singletone<Profiler>
   {
   public:
-    void Start(std::string Name)
+    static const int MAX_SCOPES = 256;
+    static const int MAX_NODES = 1024;
+    static const int MAX_DEPTH = 64;
+    // a thread stops tracing once it has this many events
+    static const int MAX_TRACE_CHUNKS = 256;
+
+    struct Frame
     {
-      ProfilerStamp ps;
-      if (Stamps.find(Name) != Stamps.end()) ps = Stamps[Name];
-      ps.Start = Timer()->GetGlobalTime();
-      Stamps[Name] = ps;
-    }
+      ProfilerScopeId Id;
+      int Node;
+      uint64 Start;
+      bool Counted;
+      uint64 Counters[COUNTER_COUNT];
+    };
 
-    void Stop(std::string Name)
+    struct ThreadData
     {
-      Stamps[Name].Stop = Timer()->GetGlobalTime();
-      uint64 Elapsed = Stamps[Name].Stop - Stamps[Name].Start;
-      //print_out("\n%20s : %15u", Name.c_str(), Elapsed);
-      Stamps[Name].Sum = Stamps[Name].Sum + Elapsed;
+      ProfilerStamp Stamps[MAX_SCOPES];
+      int ThreadIndex = 0;
+      ThreadData* Next = nullptr;
+
+      // scopes deeper than MAX_DEPTH are not timed, paths past MAX_NODES
+      // only show up in the flat report
+      Frame Stack[MAX_DEPTH];
+      int Depth = 0;
+      ProfilerNode Nodes[MAX_NODES];
+      std::atomic<int> NodeCount{ 0 };
+      int RootFirstChild = -1;
+
+      std::atomic<TraceChunk*> TraceHead{ nullptr };
+      TraceChunk* TraceTail = nullptr;
+      int TraceChunkCount = 0;
+
+      // perf event group, opened by the thread itself on first use
+      int CounterState = 0;   // 0 not tried, 1 open, -1 unavailable
+      int CounterGroup = -1;
+      int CounterSlots[COUNTER_COUNT] = { -1, -1, -1, -1 };   // position in a group read
+      int CounterFds[COUNTER_COUNT] = { -1, -1, -1, -1 };
+    };
+
+    // same id for the same name, names past MAX_SCOPES share the last slot
+    ProfilerScopeId Intern(const char* Name);
+
+    void Start(ProfilerScopeId Id)
+    {
+      ThreadData* Data = Local();
+      int Depth = Data->Depth++;
+      if (Depth >= MAX_DEPTH)
+        return;
+
+      int Parent = Depth ? Data->Stack[Depth - 1].Node : -1;
+      Frame& Top = Data->Stack[Depth];
+      Top.Id = Id;
+      Top.Node = Depth && Parent < 0 ? -1 : FindNode(Data, Id, Parent);
+      Top.Counted = Counting.load(std::memory_order_relaxed) && ReadCounters(Data, Top.Counters);
+      Top.Start = Timer()->GetGlobalTime();
     }
 
-    void Print()
+    // closes the innermost open scope, which has to be Id. Out of order it
+    // asserts, and release builds drop the sample rather than charge the time
+    // to another scope.
+    void Stop(ProfilerScopeId Id)
     {
-      for (std::map<std::string, ProfilerStamp>::const_iterator it = Stamps.begin(); it != Stamps.end(); ++it)
+      ThreadData* Data = Local();
+      if (Data->Depth == 0)
+        return;
+      int Depth = --Data->Depth;
+      if (Depth >= MAX_DEPTH)
+        return;
+
+      const Frame& Top = Data->Stack[Depth];
+      assert(Top.Id == Id && "profiler scopes closed out of order");
+      if (Top.Id != Id)
+        return;
+      uint64 Now = Timer()->GetGlobalTime();
+      uint64 Elapsed = Now - Top.Start;
+      if (Top.Counted)
+        AddCounters(Data, Top);
+      if (Tracing.load(std::memory_order_relaxed))
+        AddTraceEvent(Data, Top.Id, Top.Start, Now);
+
+      ProfilerStamp& Stamp = Data->Stamps[Top.Id];
+      Add(Stamp.Sum, Elapsed);
+      Add(Stamp.Count, 1);
+      if (Elapsed < Stamp.Min.load(std::memory_order_relaxed)) Stamp.Min.store(Elapsed, std::memory_order_relaxed);
+      if (Elapsed > Stamp.Max.load(std::memory_order_relaxed)) Stamp.Max.store(Elapsed, std::memory_order_relaxed);
+
+      ProfilerHistogram* Histogram = Stamp.Histogram.load(std::memory_order_relaxed);
+      if (!Histogram)
+        Histogram = AddHistogram(Stamp);
+      Add(Histogram->Counts[ProfilerHistogram::Bucket(Elapsed)], 1);
+
+      if (Top.Node >= 0)
       {
-        print_out("\n%20s : %15u", it->first.c_str(), it->second.Sum);
-        //print_out("\n%20s : %15.5f", it->first.c_str(), it->second.Sum/1.0e9f);
+        ProfilerNode& Node = Data->Nodes[Top.Node];
+        Add(Node.Sum, Elapsed);
+        Add(Node.Count, 1);
+        if (Node.Parent >= 0)
+          Add(Data->Nodes[Node.Parent].ChildSum, Elapsed);
       }
     }
 
+    // by name, looks the id up on every call
+    void Start(const std::string& Name) { Start(Intern(Name.c_str())); }
+    void Stop(const std::string& Name) { Stop(Intern(Name.c_str())); }
+
+    // ThreadIndex -1 merges every thread, scopes never entered are skipped
+    void Collect(std::vector<ProfilerTotal>& Out, int ThreadIndex = -1);
+    void CollectTree(std::vector<ProfilerTreeNode>& Out, int ThreadIndex = -1);
+    int GetThreadCount() const { return ThreadCount.load(); }
+
+    // flat totals with percentiles followed by the call tree, in microseconds
+    void Print();
+    void PrintThreads();
+
+    // only takes effect on platforms with perf_event_open, returns whether
+    // the calling thread could open the counters
+    bool SetHardwareCounters(bool Enabled);
+    bool IsCounting() const { return Counting.load(); }
+
+    // ring of the most recent frame durations in nanoseconds, Out receives
+    // them oldest first
+    static const int MAX_FRAMES = 256;
+    void AddFrameTime(uint64 Nanoseconds)
+    {
+      uint64 Index = FrameCount.fetch_add(1, std::memory_order_relaxed);
+      FrameTimes[Index % MAX_FRAMES].store(Nanoseconds, std::memory_order_relaxed);
+    }
+    int CollectFrameTimes(uint64* Out, int Capacity);
+
+    // zeroes every statistic and the frame ring, keeps scope ids, call paths
+    // and trace events. Scopes closing while it runs may keep their old
+    // values, so call it between frames.
+    void Reset();
+
+    // events recorded so far stay when tracing is turned off
+    void SetTracing(bool Enabled) { Tracing.store(Enabled); }
+    bool IsTracing() const { return Tracing.load(); }
+    bool WriteChromeTrace(const char* Filename);
+
   private:
-    std::map<std::string, ProfilerStamp> Stamps;
+    static void Add(std::atomic<uint64>& Counter, uint64 Value)
+    {
+      Counter.store(Counter.load(std::memory_order_relaxed) + Value, std::memory_order_relaxed);
+    }
+
+    ThreadData* Local()
+    {
+      ThreadData* Data = LocalData;
+      return Data ? Data : RegisterThread();
+    }
+
+    int FindNode(ThreadData* Data, ProfilerScopeId Id, int Parent)
+    {
+      ProfilerStamp& Stamp = Data->Stamps[Id];
+      if (Stamp.CachedParent == Parent)
+        return Stamp.CachedNode;
+      return AddNode(Data, Id, Parent);
+    }
+
+    ThreadData* RegisterThread();
+    int AddNode(ThreadData* Data, ProfilerScopeId Id, int Parent);
+    ProfilerHistogram* AddHistogram(ProfilerStamp& Stamp);
+    void AddTraceEvent(ThreadData* Data, ProfilerScopeId Id, uint64 Begin, uint64 End);
+    bool ReadCounters(ThreadData* Data, uint64* Values);
+    void AddCounters(ThreadData* Data, const Frame& Top);
+    void Report(int ThreadIndex);
+
+    static thread_local ThreadData* LocalData;
+    std::atomic<ThreadData*> Threads{ nullptr };
+    std::atomic<int> ThreadCount{ 0 };
+    std::atomic<bool> Tracing{ false };
+    std::atomic<bool> Counting{ false };
+    std::atomic<uint64> FrameCount{ 0 };
+    std::atomic<uint64> FrameTimes[MAX_FRAMES] = {};
+
+    const char* Names[MAX_SCOPES] = {};
+    std::map<std::string, ProfilerScopeId> Ids;
+    int ScopeCount = 0;
+    std::mutex InternLock;
   };
 
   extern Profiler* GProfiler();
-}
\ No newline at end of file
+
+  class ProfilerScope
+  {
+  public:
+    explicit ProfilerScope(ProfilerScopeId AId) : Id(AId) { GProfiler()->Start(Id); }
+    ~ProfilerScope() { GProfiler()->Stop(Id); }
+
+  private:
+    ProfilerScopeId Id;
+  };
+
+  // adds the lifetime of the object to the profiler's frame ring, kept apart
+  // from QUOKKA_PROFILER so frame times are there in every build
+  class ProfilerFrame
+  {
+  public:
+    ProfilerFrame() : Start(Timer()->GetGlobalTime()) {}
+    ~ProfilerFrame() { GProfiler()->AddFrameTime(Timer()->GetGlobalTime() - Start); }
+
+  private:
+    uint64 Start;
+  };
+}
+
+#define QUOKKA_CONCAT_IMPL(a, b) a##b
+#define QUOKKA_CONCAT(a, b) QUOKKA_CONCAT_IMPL(a, b)
+
+#if QUOKKA_PROFILER
+#define QUOKKA_PROFILE_SCOPE(name) \
+  static const quokka::ProfilerScopeId QUOKKA_CONCAT(quokka_scope_id_, __LINE__) = quokka::GProfiler()->Intern(name); \
+  quokka::ProfilerScope QUOKKA_CONCAT(quokka_scope_, __LINE__)(QUOKKA_CONCAT(quokka_scope_id_, __LINE__))
+#else
+#define QUOKKA_PROFILE_SCOPE(name) ((void)0)
+#endif
@@ -9,7 +9,7 @@ struct vec3
 {
   float x, y, z;
 
-  float length()
+  float length() const
   {
     return sqrtf(x*x + y*y + z*z);
   }
@@ -23,7 +23,7 @@ struct vec3
     return *this;
   }
 
-  vec3 operator *(float f)
+  vec3 operator *(float f) const
   {
     vec3 res = *this;
     res.x *= f;
@@ -32,7 +32,7 @@ struct vec3
     return res;
   }
 
-  vec3 operator /(float f)
+  vec3 operator /(float f) const
   {
     vec3 res = *this;
     res.x /= f;
@@ -41,24 +41,24 @@ struct vec3
     return res;
   }
 
-  vec3 operator-(vec3 v)
+  vec3 operator-(vec3 v) const
   {
     vec3 res = { this->x - v.x, this->y - v.y, this->z - v.z };
     return res;
   }
 
-  vec3 operator+(vec3 v)
+  vec3 operator+(vec3 v) const
   {
     vec3 res = { this->x + v.x, this->y + v.y, this->z + v.z };
     return res;
   }
 
-  static float dot(vec3& a, vec3& b)
+  static float dot(const vec3& a, const vec3& b)
   {
     return a.x*b.x + a.y*b.y + a.z*b.z;
   }
 
-  static vec3 cross(vec3& a, vec3& b)
+  static vec3 cross(const vec3& a, const vec3& b)
   {
     vec3 res = { a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.y*b.x - a.x*b.y };
     return res;
@@ -78,7 +78,7 @@ struct mat3x3
   float _21 = 0.f, _22 = 0.f, _23 = 0.f;
   float _31 = 0.f, _32 = 0.f, _33 = 0.f;
 
-  vec3 operator *(vec3 v)
+  vec3 operator *(vec3 v) const
   {
     vec3 result;
     result.x = this->_11*v.x + this->_12*v.y + this->_13*v.z;
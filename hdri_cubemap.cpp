@@ -1,26 +1,45 @@
 #include "hdri_cubemap.h"
 #include "big_quokka.h"
+#include "progress.h"
 
-void SImage::open_hdri(const char* filename)
+bool SImage::open_hdri(const char* filename, progress_token* progress)
 {
   if (pixels) delete[] pixels;
+  pixels = nullptr;
+  width = height = 0;
 
   FILE* f;
 
   errno_t err = fopen_s(&f, filename, "rb");
+  if (err != 0 || !f)
+    return false;
   rgbe_header_info header;
 
-  RGBE_ReadHeader(f, &width, &height, NULL);
+  int w = 0, h = 0;
+  if (RGBE_ReadHeader(f, &w, &h, NULL) != RGBE_RETURN_SUCCESS)
+  {
+    fclose(f);
+    return false;
+  }
 
   // read pixels
-  float* data = new float[width*height * 3];
-  RGBE_ReadPixels_RLE(f, data, width, height);
+  float* data = new float[w*h * 3];
+  int result = RGBE_ReadPixels_RLE(f, data, w, h, progress);
   fclose(f);
 
+  if (result != RGBE_RETURN_SUCCESS)
+  {
+    delete[] data;
+    return false;
+  }
+
+  width = w;
+  height = h;
   pixels = new pixel[width*height];
   memcpy(pixels, data, sizeof(float)* 3 * width*height);
 
   delete[] data;
+  return true;
 }
 
 void turn_right(pixel* edge, int cube_edge_i)
@@ -101,7 +120,7 @@ void write_hdri_cross(const char* filename, const pixel** edges, int cube_edge)
   }
 }
 
-void write_dds_cubemap(const char* filename, pixel** edges, int cube_edge_i)
+bool write_dds_cubemap(const char* filename, pixel** edges, int cube_edge_i, progress_token* progress)
 {
   DDS_HEADER header;
   header.dwMipMapCount = 0;
@@ -110,29 +129,44 @@ void write_dds_cubemap(const char* filename, pixel** edges, int cube_edge_i)
 
   FILE* f;
   errno_t err = fopen_s(&f, filename, "wb");
+  if (err != 0 || !f)
+    return false;
 
   fwrite(&DDS_MAGIC_NUMBER, sizeof(DWORD), 1, f);
   fwrite(&header, sizeof(DDS_HEADER), 1, f);
 
+  progress_begin(progress, 6 * cube_edge_i);
+  bool cancelled = false;
+
   unsigned char* out_data = new unsigned char[cube_edge_i*cube_edge_i * 4];
-  for (int i = 0; i < 6; i++)
+  for (int i = 0; i < 6 && !cancelled; i++)
   {
-    for (int j = 0; j < cube_edge_i*cube_edge_i; j++)
+    for (int row = 0; row < cube_edge_i && !cancelled; row++)
     {
-      out_data[j * 4 + 0] = edges[i][j].b >= 1.f ? 255 : edges[i][j].b * 255;
-      out_data[j * 4 + 1] = edges[i][j].g >= 1.f ? 255 : edges[i][j].g * 255;
-      out_data[j * 4 + 2] = edges[i][j].r >= 1.f ? 255 : edges[i][j].r * 255;
-      out_data[j * 4 + 3] = 255;
+      for (int j = row * cube_edge_i; j < (row + 1) * cube_edge_i; j++)
+      {
+        out_data[j * 4 + 0] = edges[i][j].b >= 1.f ? 255 : edges[i][j].b * 255;
+        out_data[j * 4 + 1] = edges[i][j].g >= 1.f ? 255 : edges[i][j].g * 255;
+        out_data[j * 4 + 2] = edges[i][j].r >= 1.f ? 255 : edges[i][j].r * 255;
+        out_data[j * 4 + 3] = 255;
+      }
+      cancelled = !progress_step(progress);
     }
-    fwrite(out_data, sizeof(unsigned char), cube_edge_i*cube_edge_i * 4, f);
+    if (!cancelled)
+      fwrite(out_data, sizeof(unsigned char), cube_edge_i*cube_edge_i * 4, f);
   }
 
   delete[] out_data;
 
+  bool ok = !cancelled && !ferror(f);
   fclose(f);
+  if (!ok)
+    remove(filename);
+  return ok;
 }
 
 SCube::SCube() {
+  cube_edge_i = 0;
   for (int i = 0; i < 6; i++)
   {
     edges[i] = nullptr;
@@ -146,6 +180,8 @@ void SCube::clear_edges()
   {
     if (edges[i]) delete[] edges[i];
     if (blurred_edges[i]) delete[] blurred_edges[i];
+    edges[i] = nullptr;
+    blurred_edges[i] = nullptr;
   }
 }
 
@@ -200,7 +236,8 @@ pixel* SCube::get_unreal_cubemap()
   return diffuse;
 }
 
-void SCube::make_cube(pixel* pixels, int width, int height, int cube_edge_i, float angle_degrees_z)
+bool SCube::make_cube(pixel* pixels, int width, int height, int cube_edge_i, float angle_degrees_z,
+  progress_token* progress)
 {
   clear_edges();
 
@@ -218,10 +255,22 @@ void SCube::make_cube(pixel* pixels, int width, int height, int cube_edge_i, flo
 
   float angle_z = M_PI * angle_degrees_z / 180.f;
 
+  progress_begin(progress, 6 * 2 * half_edge);
+
   for (int i = 0; i < 6; i++)
   {
-    edges[i] = new pixel[cube_edge_i*cube_edge_i];
-    blurred_edges[i] = new pixel[cube_edge_i*cube_edge_i];
+    // leaves an empty cube rather than a partial one when an edge is too big
+    try
+    {
+      edges[i] = new pixel[cube_edge_i*cube_edge_i];
+      blurred_edges[i] = new pixel[cube_edge_i*cube_edge_i];
+    }
+    catch (...)
+    {
+      clear_edges();
+      this->cube_edge_i = 0;
+      throw;
+    }
 
     for (int c1 = -half_edge; c1 < half_edge; c1 += 1)
     {
@@ -257,6 +306,13 @@ void SCube::make_cube(pixel* pixels, int width, int height, int cube_edge_i, flo
         int index = (c1 + half_edge) + cube_edge_i*(c2 + half_edge);
         if (index < cube_edge_i*cube_edge_i && index >= 0) edges[i][index] = p;
       }
+
+      if (!progress_step(progress))
+      {
+        clear_edges();
+        this->cube_edge_i = 0;
+        return false;
+      }
     }
   }
 
@@ -273,6 +329,7 @@ void SCube::make_cube(pixel* pixels, int width, int height, int cube_edge_i, flo
 
   for (int i = 0; i < 6; i++)
     memcpy(blurred_edges[i], edges[i], sizeof(pixel)*cube_edge_i*cube_edge_i);
+  return true;
 }
 
 void SCube::turn_right(Surface s)
@@ -366,7 +423,7 @@ void SCube::assign_borders(pixel* top, pixel* bottom, pixel* left, pixel* right,
   }
 }
 
-void SCube::blur(int power)
+bool SCube::blur(int power, progress_token* progress)
 {
   int cube_edge_i_2 = cube_edge_i + 2;
   int cube_edge_i_1 = cube_edge_i + 1;
@@ -382,35 +439,40 @@ void SCube::blur(int power)
   pixel* new_edges[6];
   for (int i = 0; i < 6; i++) new_edges[i] = new pixel[cube_edge_i*cube_edge_i];
 
-  for (int p = 0; p < power; p++)
+  progress_begin(progress, 6LL * (power > 0 ? power : 0));
+  bool cancelled = false;
+
+  for (int p = 0; p < power && !cancelled; p++)
   {
-    for (int k = 0; k < 6; k++)
+    for (int k = 0; k < 6 && !cancelled; k++)
     {
-      quokka::GProfiler()->Start("assign_borders");
-      assign_borders(top, bottom, left, right, (Surface)k);
-      quokka::GProfiler()->Stop("assign_borders");
+      {
+        QUOKKA_PROFILE_SCOPE("assign_borders");
+        assign_borders(top, bottom, left, right, (Surface)k);
+      }
 
       pixel* ext_edge = new pixel[(cube_edge_i + 2)*(cube_edge_i + 2)];
 
-      quokka::GProfiler()->Start("init_ext_edge");
-      for (int j = 1; j < cube_edge_i_1; j++)
-        memcpy(&ext_edge[j*cube_edge_i_2 + 1], &blurred_edges[k][(j - 1)*cube_edge_i], sizeof(pixel)*cube_edge_i);
-
-      for (int i = 1; i < cube_edge_i + 1; i++)
       {
-        ext_edge[i] = top[i - 1];
-        ext_edge[i*cube_edge_i_2] = left[i - 1];
-        ext_edge[(i + 1)*cube_edge_i_2 - 1] = right[i - 1];
-        ext_edge[cube_edge_i_2*cube_edge_i_1 + i] = bottom[i - 1];
+        QUOKKA_PROFILE_SCOPE("init_ext_edge");
+        for (int j = 1; j < cube_edge_i_1; j++)
+          memcpy(&ext_edge[j*cube_edge_i_2 + 1], &blurred_edges[k][(j - 1)*cube_edge_i], sizeof(pixel)*cube_edge_i);
+
+        for (int i = 1; i < cube_edge_i + 1; i++)
+        {
+          ext_edge[i] = top[i - 1];
+          ext_edge[i*cube_edge_i_2] = left[i - 1];
+          ext_edge[(i + 1)*cube_edge_i_2 - 1] = right[i - 1];
+          ext_edge[cube_edge_i_2*cube_edge_i_1 + i] = bottom[i - 1];
+        }
+
+        ext_edge[0] = (ext_edge[1] + ext_edge[cube_edge_i_2]) / 2;
+        ext_edge[cube_edge_i_1] = (ext_edge[cube_edge_i - 1] + ext_edge[2 * (cube_edge_i_2)-1]) / 2;
+        ext_edge[cube_edge_i_2*cube_edge_i_1] = (ext_edge[cube_edge_i_2*cube_edge_i_1 + 1] + ext_edge[cube_edge_i * cube_edge_i_2]) / 2;
+        ext_edge[cube_edge_i_2*cube_edge_i_2 - 1] = (ext_edge[cube_edge_i_2*cube_edge_i_2 - 2] + ext_edge[cube_edge_i_2*cube_edge_i_1]) / 2;
       }
 
-      ext_edge[0] = (ext_edge[1] + ext_edge[cube_edge_i_2]) / 2;
-      ext_edge[cube_edge_i_1] = (ext_edge[cube_edge_i - 1] + ext_edge[2 * (cube_edge_i_2)-1]) / 2;
-      ext_edge[cube_edge_i_2*cube_edge_i_1] = (ext_edge[cube_edge_i_2*cube_edge_i_1 + 1] + ext_edge[cube_edge_i * cube_edge_i_2]) / 2;
-      ext_edge[cube_edge_i_2*cube_edge_i_2 - 1] = (ext_edge[cube_edge_i_2*cube_edge_i_2 - 2] + ext_edge[cube_edge_i_2*cube_edge_i_1]) / 2;
-      quokka::GProfiler()->Stop("init_ext_edge");
-
-      quokka::GProfiler()->Start("sum");
+      QUOKKA_PROFILE_SCOPE("sum");
       for (int i = 1; i < cube_edge_i_1; i++)
       for (int j = 1; j < cube_edge_i_1; j++)
       {
@@ -433,14 +495,30 @@ void SCube::blur(int power)
           ext_edge[i + j*cube_edge_i_2]
           ) / 9;
       }
-      quokka::GProfiler()->Stop("sum");
+
+      delete[] ext_edge;
+      cancelled = !progress_step(progress);
     }
-    quokka::GProfiler()->Start("back_to_edge");
+    if (cancelled)
+      break;
+
+    QUOKKA_PROFILE_SCOPE("back_to_edge");
     for (int i = 0; i < 6; i++)
       memcpy(blurred_edges[i], new_edges[i], sizeof(pixel)*cube_edge_i*cube_edge_i);
-    quokka::GProfiler()->Stop("back_to_edge");
   }
 
   for (int i = 0; i < 6; i++) delete[] new_edges[i];
 
+  delete[] top;
+  delete[] bottom;
+  delete[] left;
+  delete[] right;
+
+  if (cancelled)
+  {
+    for (int i = 0; i < 6; i++)
+      memcpy(blurred_edges[i], edges[i], sizeof(pixel)*cube_edge_i*cube_edge_i);
+    return false;
+  }
+  return true;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "renderer.h"
 #include "dds.h"
 
+struct progress_token;
+
 struct SImage
 {
   int width = 0;
@@ -13,7 +15,9 @@ struct SImage
 
   pixel* pixels = nullptr;
 
-  void open_hdri(const char* filename);
+  // false when the file can't be read or progress was cancelled, the image
+  // is empty then
+  bool open_hdri(const char* filename, progress_token* progress = nullptr);
 };
 
 enum class Surface
@@ -29,7 +33,8 @@ enum class Surface
 void turn_right(pixel* edge, int cube_edge_i);
 void assign_xyz(float& x, float& y, float& z, int c1, int c2, int half_edge, Surface surf);
 void write_hdri_cross(const char* filename, const pixel** edges, int cube_edge);
-void write_dds_cubemap(const char* filename, pixel** edges, int cube_edge_i);
+// false on I/O failure or cancellation, no file is left behind then
+bool write_dds_cubemap(const char* filename, pixel** edges, int cube_edge_i, progress_token* progress = nullptr);
 
 struct SCube
 {
@@ -44,13 +49,18 @@ struct SCube
 
   pixel* get_unreal_cubemap();
 
-  void make_cube(pixel* pixels, int width, int height, int cube_edge_i, float angle_degrees_z = 0.0f);
+  // progress steps once per texel row of a face. Cancelling leaves the cube
+  // without faces, as before the first make_cube, and returns false.
+  bool make_cube(pixel* pixels, int width, int height, int cube_edge_i, float angle_degrees_z = 0.0f,
+    progress_token* progress = nullptr);
   void turn_right(Surface s);
 
   void flip_x(Surface s);
   void flip_y(Surface s);
   void assign_borders(pixel* top, pixel* bottom, pixel* left, pixel* right, Surface k);
-  void blur(int power);
+  // progress steps once per face and pass. Cancelling puts the unblurred
+  // faces back into blurred_edges and returns false.
+  bool blur(int power, progress_token* progress = nullptr);
 
   pixel* edges[6];
   pixel* blurred_edges[6];
@@ -1,87 +1,332 @@
 
 #include <algorithm>
 #include <math.h>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 
 #ifdef _DEBUG
 #include "ConsoleWindow.h"
-#include "MemoryCounter.h"
 #endif
 
 #include "big_quokka.h"
+#include "MemoryTracker.h"
 
+#include "async_job.h"
 #include "hdri_cubemap.h"
+#include "texture.h"
+#include "worker_pool.h"
 
-namespace quokka
+#include <memory>
+#include <string>
+
+// Everything one conversion needs: source image, cube, preview meshes and
+// texture, renderer and its targets. The quokka_* exports take one of these
+// as a handle, the older exports use default_context.
+struct quokka_context
 {
-  Profiler* Profiler::Instance = new Profiler();
-  Profiler* GProfiler() { return Profiler::GetInstance(); }
-}
+  static const int MAX_RENDER_TARGETS = 3;
 
-struct Singletone
-{ 
-  Singletone()
+  ~quokka_context()
   {
-    rendered_image = new pixel[1024 * 1024];
+    jobs.wait_idle();
+    release_render_targets();
+    delete[] diffuse;
   }
 
   SImage image;
   SCube cube;
 
+  // steps queued by the *_async exports
+  job_queue jobs;
+
   model sphere;
   model sphere_inv;
 
   void init()
   {    
-    sphere.from_file("skysphere.obj");    
-    sphere_inv.from_file("skysphere_inv.obj");    
+    sphere.from_sky_sphere(false);
+    sphere_inv.from_sky_sphere(true);
   }
 
-  pixel* rendered_image = nullptr;  
+  // ring of library-owned targets for render(), a returned frame stays valid
+  // until render_target_count - 1 further frames have been rendered
+  unsigned char* render_targets[MAX_RENDER_TARGETS] = { nullptr, nullptr, nullptr };
+  int render_target_count = 2;
+  int current_target = -1;
+  target_format render_targets_format = target_format::RGB32F;
+
+  // what render_frame() hands out
+  target_format frame_format = target_format::RGB32F;
+
+  // diffuse strip and its mip chain are rebuilt only after the cube has changed
+  pixel* diffuse = nullptr;
+  mip_texture preview_texture;
+  bool diffuse_dirty = true;
 
   renderer _renderer;
+  render_mode mode = render_mode::MESH;
+  sky_camera camera;
+
+  void release_render_targets()
+  {
+    for (int i = 0; i < MAX_RENDER_TARGETS; i++)
+    {
+      delete[] render_targets[i];
+      render_targets[i] = nullptr;
+    }
+    current_target = -1;
+  }
+
+  void set_render_size(int width, int height)
+  {
+    if (width <= 0 || height <= 0) return;
+    if (width == _renderer.width && height == _renderer.height) return;
+
+    release_render_targets();
+    _renderer.resize(width, height);
+  }
+
+  void set_render_target_count(int count)
+  {
+    if (count < 1) count = 1;
+    if (count > MAX_RENDER_TARGETS) count = MAX_RENDER_TARGETS;
+
+    release_render_targets();
+    render_target_count = count;
+  }
+
+  void invalidate_diffuse() { diffuse_dirty = true; }
+
+  // the conversion steps, progress is null for the blocking exports and
+  // the job's token for the *_async ones, false when cancelled or failed.
+  // Each one fails when the step before it left nothing to work on.
+
+  bool open_hdri(const char* filename, progress_token* progress = nullptr)
+  {
+    quokka::MemoryTagScope tag(quokka::MEMORY_TAG_DECODE);
+    return image.open_hdri(filename, progress);
+  }
+
+  bool make_cube(int cube_edge_i, float degrees, progress_token* progress = nullptr)
+  {
+    QUOKKA_PROFILE_SCOPE("make_cube");
+    quokka::MemoryTagScope tag(quokka::MEMORY_TAG_CUBE);
+    if (!image.pixels || image.width <= 0 || image.height <= 0)
+      return false;
+    invalidate_diffuse();
+    return cube.make_cube(image.pixels, image.width, image.height, cube_edge_i, degrees, progress);
+  }
+
+  bool save_cube_dds(const char* filename, int cube_edge_i, progress_token* progress = nullptr)
+  {
+    if (!cube.edges[0])
+      return false;
+    quokka::MemoryTagScope tag(quokka::MEMORY_TAG_CUBE);
+    cube.turn_right(Surface::X_P);
+    cube.turn_right(Surface::X_P);
+    cube.turn_right(Surface::X_P);
+    cube.turn_right(Surface::X_N);
+    cube.turn_right(Surface::Y_P);
+    cube.turn_right(Surface::Y_P);
+    invalidate_diffuse();
+
+    return write_dds_cubemap(filename, cube.blurred_edges, cube_edge_i, progress);
+  }
 
-  pixel* render(float z_angle)
+  bool blur(int power, progress_token* progress = nullptr)
   {
-    if (rendered_image) delete[] rendered_image;
+    QUOKKA_PROFILE_SCOPE("blur");
+    if (!cube.edges[0])
+      return false;
+    quokka::MemoryTagScope tag(quokka::MEMORY_TAG_BLUR);
+    invalidate_diffuse();
+    return cube.blur(power, progress);
+  }
+
+  void* render(float z_angle, target_format format)
+  {
+    if (format != render_targets_format)
+    {
+      release_render_targets();
+      render_targets_format = format;
+    }
+
+    current_target = (current_target + 1) % render_target_count;
 
-    rendered_image = new pixel[1024 * 1024];
+    unsigned char*& target = render_targets[current_target];
+    if (!target)
+      target = new unsigned char[target_bytes_per_pixel(format) * _renderer.width * _renderer.height];
+
+    render_to(z_angle, target, format);
+    return target;
+  }
+
+  void prepare_preview()
+  {
+    if (diffuse_dirty)
+    {
+      delete[] diffuse;
+      diffuse = cube.get_unreal_cubemap();
+      preview_texture.build(diffuse, cube.cube_edge_i, 6);
+      diffuse_dirty = false;
+    }
 
-    pixel* diffuse = cube.get_unreal_cubemap();
     int diffuse_w = cube.cube_edge_i * 6;
     int diffuse_h = cube.cube_edge_i;
     
     sphere.diffuse = diffuse;
     sphere.d_height = diffuse_h;
     sphere.d_width = diffuse_w;
-    sphere.set_rotation(z_angle);
+    sphere.texture = &preview_texture;
     
     sphere_inv.diffuse = diffuse;
     sphere_inv.d_height = diffuse_h;
     sphere_inv.d_width = diffuse_w;
+    sphere_inv.texture = &preview_texture;
     sphere_inv.scale = 2.f;
+  }
+
+  // turning the environment by z_angle is turning the camera the other way
+  sky_camera sky_view(float z_angle) const
+  {
+    sky_camera view = camera;
+    view.yaw -= z_angle;
+    return view;
+  }
+
+  // target must hold get_render_width() * get_render_height() pixels of
+  // the given format
+  void render_to(float z_angle, void* target, target_format format = target_format::RGB32F)
+  {
+    QUOKKA_PROFILE_SCOPE("frame");
+    quokka::ProfilerFrame frame_time;
+    quokka::MemoryTagScope tag(quokka::MEMORY_TAG_RENDER);
+    prepare_preview();
+
+    if (mode == render_mode::SKY)
+    {
+      QUOKKA_PROFILE_SCOPE("sky");
+      _renderer.draw_sky(sky_view(z_angle), preview_texture);
+    }
+    else
+    {
+      draw_spheres(z_angle);
+    }
+
+    QUOKKA_PROFILE_SCOPE("resolve");
+    _renderer.resolve(target, format);
+  }
+
+  void draw_spheres(float z_angle)
+  {
+    sphere.set_rotation(z_angle);
     
+    // the deferred resolve writes every pixel, background included
+    if (!_renderer.deferred)
+      _renderer.clear();
     _renderer.clear_z();
-    quokka::GProfiler()->Start("sphere");
-    _renderer.draw_triangular_model(sphere, rendered_image);
-    quokka::GProfiler()->Stop("sphere");
+    {
+      QUOKKA_PROFILE_SCOPE("sphere");
+      _renderer.draw_triangular_model(sphere);
+    }
+    {
+      QUOKKA_PROFILE_SCOPE("sphere_inv");
+      _renderer.draw_triangular_model(sphere_inv);
+    }
+
+    if (_renderer.deferred)
+    {
+      QUOKKA_PROFILE_SCOPE("shade");
+      _renderer.resolve_deferred();
+    }
+  }
 
-    quokka::GProfiler()->Start("sphere_inv");
-    _renderer.draw_triangular_model(sphere_inv, rendered_image);
-    quokka::GProfiler()->Stop("sphere_inv");
-    
-    delete[] diffuse;
+  // one per thread taking part in render_batch, kept between calls
+  struct batch_view
+  {
+    renderer _renderer;
+    model_instance sphere_view;
+    model_instance sphere_inv_view;
+  };
+  std::vector<std::unique_ptr<batch_view>> batch_views;
+
+  // renders count angles into consecutive frames of target. The texture and
+  // the meshes are prepared once, views run in parallel on the worker pool,
+  // each with its own buffers.
+  void render_batch(const float* z_angles, int count, void* target, target_format format)
+  {
+    if (count <= 0)
+      return;
+
+    prepare_preview();
+
+    int slots = std::min(count, global_worker_pool().size() + 1);
+    while ((int)batch_views.size() < slots)
+      batch_views.emplace_back(new batch_view());
+
+    size_t frame_bytes = (size_t)target_bytes_per_pixel(format) * _renderer.width * _renderer.height;
+
+    QUOKKA_PROFILE_SCOPE("render_batch");
+    quokka::MemoryTagScope tag(quokka::MEMORY_TAG_RENDER);
+    global_worker_pool().parallel_for(slots, 1, [&](int slot_begin, int slot_end)
+    {
+      for (int slot = slot_begin; slot < slot_end; slot++)
+      {
+        batch_view& view = *batch_views[slot];
+        renderer& r = view._renderer;
+        r.resize(_renderer.width, _renderer.height);
+        r.deferred = _renderer.deferred;
+        r.exposure = _renderer.exposure;
+        r.light = _renderer.light;
+        r.triangles_per_pixel = _renderer.triangles_per_pixel;
+
+        for (int k = slot; k < count; k += slots)
+        {
+          // every batch frame lands in the frame ring, timed on its own thread
+          quokka::ProfilerFrame frame_time;
+          draw_batch_view(view, z_angles[k]);
+          r.resolve((unsigned char*)target + frame_bytes * k, format);
+        }
+      }
+    });
+  }
 
-    return rendered_image;
+  void draw_batch_view(batch_view& view, float z_angle)
+  {
+    QUOKKA_PROFILE_SCOPE("batch_view");
+    renderer& r = view._renderer;
+
+    if (mode == render_mode::SKY)
+    {
+      r.draw_sky(sky_view(z_angle), preview_texture);
+      return;
+    }
+
+    view.sphere_view.update(sphere, sphere.scale, mat3x3::make_z_matrix(z_angle), r.light,
+      r.select_lod(sphere, sphere.scale));
+    view.sphere_inv_view.update(sphere_inv, sphere_inv.scale, sphere_inv.rot_z, r.light,
+      r.select_lod(sphere_inv, sphere_inv.scale));
+
+    if (!r.deferred)
+      r.clear();
+    r.clear_z();
+    r.draw_triangular_model(sphere, view.sphere_view);
+    r.draw_triangular_model(sphere_inv, view.sphere_inv_view);
+    if (r.deferred)
+      r.resolve_deferred();
   }
 
-} Singletone;
+};
+
+// what the exports without a context argument work on, the API as it was
+// before contexts existed
+static quokka_context default_context;
 
 extern "C" __declspec(dllexport)
 void init()
 {
-  Singletone.init();
+  default_context.init();
 #ifdef _DEBUG
   CreateConsole();
 #endif
@@ -92,72 +337,324 @@ void deinit()
 {
 #ifdef _DEBUG
   quokka::GProfiler()->Print();
+  quokka::GProfiler()->PrintThreads();
+  quokka::PrintMemoryUsage();
 #endif
 }
 
-extern "C" __declspec(dllexport)
-void open_hdri(const char* filename)
+// timeline of every profiler scope, written as Chrome trace JSON
+extern "C" __declspec(dllexport) void set_profiler_trace(int enabled) { quokka::GProfiler()->SetTracing(enabled != 0); }
+extern "C" __declspec(dllexport) int save_profiler_trace(const char* filename) { return quokka::GProfiler()->WriteChromeTrace(filename) ? 1 : 0; }
+// cycles, instructions, LLC and branch misses per scope where the platform
+// allows it, returns 0 when only timing is available
+extern "C" __declspec(dllexport) int set_profiler_counters(int enabled) { return quokka::GProfiler()->SetHardwareCounters(enabled != 0) ? 1 : 0; }
+
+// plain snapshot of one profiler scope for the host, merged over all threads,
+// times in nanoseconds, counters are zero without hardware counter support
+struct profiler_scope_stats
+{
+  char name[32];
+  unsigned long long total_ns;
+  unsigned long long calls;
+  unsigned long long min_ns;
+  unsigned long long max_ns;
+  unsigned long long p50_ns;
+  unsigned long long p90_ns;
+  unsigned long long p99_ns;
+  unsigned long long cycles;
+  unsigned long long instructions;
+  unsigned long long llc_misses;
+  unsigned long long branch_misses;
+};
+
+// fills up to capacity entries and returns how many scopes there are, call
+// with stats = NULL to size the array
+extern "C" __declspec(dllexport) int get_profiler_stats(profiler_scope_stats* stats, int capacity)
 {
-  Singletone.image.open_hdri(filename);
+  std::vector<quokka::ProfilerTotal> totals;
+  quokka::GProfiler()->Collect(totals);
+
+  int count = std::min((int)totals.size(), stats ? capacity : 0);
+  for (int i = 0; i < count; i++)
+  {
+    const quokka::ProfilerTotal& total = totals[i];
+    profiler_scope_stats& out = stats[i];
+
+    int n = 0;
+    for (; n < (int)sizeof(out.name) - 1 && total.Name && total.Name[n]; n++)
+      out.name[n] = total.Name[n];
+    out.name[n] = 0;
+
+    out.total_ns = total.Sum;
+    out.calls = total.Count;
+    out.min_ns = total.Min;
+    out.max_ns = total.Max;
+    out.p50_ns = total.P50;
+    out.p90_ns = total.P90;
+    out.p99_ns = total.P99;
+    out.cycles = total.Counters[quokka::COUNTER_CYCLES];
+    out.instructions = total.Counters[quokka::COUNTER_INSTRUCTIONS];
+    out.llc_misses = total.Counters[quokka::COUNTER_LLC_MISSES];
+    out.branch_misses = total.Counters[quokka::COUNTER_BRANCH_MISSES];
+  }
+  return (int)totals.size();
 }
 
-extern "C" __declspec(dllexport)
-void make_cube(int cube_edge_i, float degrees)
+// durations of the last frames rendered through render, render_to and
+// render_batch, oldest first, returns how many were written. Pass NULL to get
+// how many are kept.
+extern "C" __declspec(dllexport) int get_frame_times(float* milliseconds, int capacity)
 {
-  Singletone.cube.make_cube(
-    Singletone.image.pixels,
-    Singletone.image.width,
-    Singletone.image.height,
-    cube_edge_i, degrees);
+  unsigned long long ns[quokka::Profiler::MAX_FRAMES];
+  if (!milliseconds)
+    return quokka::GProfiler()->CollectFrameTimes(ns, quokka::Profiler::MAX_FRAMES);
+  int count = quokka::GProfiler()->CollectFrameTimes(ns, std::min(capacity, (int)quokka::Profiler::MAX_FRAMES));
+  for (int i = 0; i < count; i++)
+    milliseconds[i] = float(ns[i] / 1.0e6);
+  return count;
 }
 
-extern "C" __declspec(dllexport)
-void save_cube_dds(const char* filename, int cube_edge_i)
+extern "C" __declspec(dllexport) void reset_profiler() { quokka::GProfiler()->Reset(); }
+
+// bytes held by the library, tag is 0 other, 1 decode, 2 cube, 3 blur,
+// 4 render or -1 for the total
+struct memory_usage
+{
+  unsigned long long current_bytes;
+  unsigned long long peak_bytes;
+  unsigned long long allocations;
+  unsigned long long live_allocations;
+};
+
+extern "C" __declspec(dllexport) void get_memory_usage(int tag, memory_usage* usage)
+{
+  if (!usage)
+    return;
+  quokka::MemoryUsage u = quokka::GetMemoryUsage(tag);
+  usage->current_bytes = u.CurrentBytes;
+  usage->peak_bytes = u.PeakBytes;
+  usage->allocations = u.Allocations;
+  usage->live_allocations = u.LiveAllocations;
+}
+
+// 64 entries each, entry c counts sizes in [2^c, 2^(c+1)), either may be NULL
+extern "C" __declspec(dllexport) void get_memory_size_classes(unsigned long long* allocations, unsigned long long* live_allocations)
+{
+  quokka::GetMemorySizeClasses(allocations, live_allocations);
+}
+
+extern "C" __declspec(dllexport) void reset_memory_peaks() { quokka::ResetMemoryPeaks(); }
+
+// Contexts are independent of each other, so a host can convert several
+// environments at once with one context per thread. Calls on one context
+// must not overlap. Profiler, memory tracker and worker pool stay shared.
+extern "C" __declspec(dllexport) quokka_context* quokka_create()
+{
+  quokka_context* context = new quokka_context();
+  context->init();
+  return context;
+}
+
+extern "C" __declspec(dllexport) void quokka_destroy(quokka_context* context) { delete context; }
+
+// stops the shared worker threads, call it before unloading the library once
+// every context is destroyed. The legacy context's queued jobs are finished
+// first. Using the library afterwards starts the threads again.
+extern "C" __declspec(dllexport) void quokka_shutdown()
 {
-  Singletone.cube.turn_right(Surface::X_P);
-  Singletone.cube.turn_right(Surface::X_P);
-  Singletone.cube.turn_right(Surface::X_P);
-  Singletone.cube.turn_right(Surface::X_N);
-  Singletone.cube.turn_right(Surface::Y_P);
-  Singletone.cube.turn_right(Surface::Y_P);
-
-  write_dds_cubemap(filename, Singletone.cube.blurred_edges, cube_edge_i);
+  default_context.jobs.wait_idle();
+  shutdown_global_worker_pool();
 }
 
-extern "C" __declspec(dllexport) int get_width()  { return Singletone.image.width; }
-extern "C" __declspec(dllexport) int get_height() { return Singletone.image.height; }
+extern "C" __declspec(dllexport) void quokka_open_hdri(quokka_context* context, const char* filename) { context->open_hdri(filename); }
+extern "C" __declspec(dllexport) void quokka_make_cube(quokka_context* context, int cube_edge_i, float degrees) { context->make_cube(cube_edge_i, degrees); }
+extern "C" __declspec(dllexport) void quokka_save_cube_dds(quokka_context* context, const char* filename, int cube_edge_i) { context->save_cube_dds(filename, cube_edge_i); }
+extern "C" __declspec(dllexport) void quokka_blur(quokka_context* context, int power) { context->blur(power); }
 
-extern "C" __declspec(dllexport) pixel* get_pixels() { return Singletone.image.pixels; }
-extern "C" __declspec(dllexport) pixel* get_edge(int i) { return Singletone.cube.edges[i]; }
-extern "C" __declspec(dllexport) pixel* get_blurred_edge(int i) { return Singletone.cube.blurred_edges[i]; }
-extern "C" __declspec(dllexport) pixel* get_edge_t(int i, int turns)
+extern "C" __declspec(dllexport) int quokka_get_width(quokka_context* context)  { return context->image.width; }
+extern "C" __declspec(dllexport) int quokka_get_height(quokka_context* context) { return context->image.height; }
+
+extern "C" __declspec(dllexport) pixel* quokka_get_pixels(quokka_context* context) { return context->image.pixels; }
+extern "C" __declspec(dllexport) pixel* quokka_get_edge(quokka_context* context, int i) { return context->cube.edges[i]; }
+extern "C" __declspec(dllexport) pixel* quokka_get_blurred_edge(quokka_context* context, int i) { return context->cube.blurred_edges[i]; }
+extern "C" __declspec(dllexport) pixel* quokka_get_edge_t(quokka_context* context, int i, int turns)
 {
-  int cube_edge_i = Singletone.cube.cube_edge_i;
+  int cube_edge_i = context->cube.cube_edge_i;
 
   pixel* edge = new pixel[cube_edge_i*cube_edge_i];
-  memcpy(edge, Singletone.cube.edges[i], sizeof(pixel)*cube_edge_i*cube_edge_i);
+  memcpy(edge, context->cube.edges[i], sizeof(pixel)*cube_edge_i*cube_edge_i);
   for (int i = 0; i < turns; i++)
     turn_right(edge, cube_edge_i);
 
   return edge;
 }
 
-extern "C" __declspec(dllexport) pixel* get_blurred_edge_t(int i, int turns)
+extern "C" __declspec(dllexport) pixel* quokka_get_blurred_edge_t(quokka_context* context, int i, int turns)
 {
-  int cube_edge_i = Singletone.cube.cube_edge_i;
+  int cube_edge_i = context->cube.cube_edge_i;
 
   pixel* edge = new pixel[cube_edge_i*cube_edge_i];
-  memcpy(edge, Singletone.cube.blurred_edges[i], sizeof(pixel)*cube_edge_i*cube_edge_i);
+  memcpy(edge, context->cube.blurred_edges[i], sizeof(pixel)*cube_edge_i*cube_edge_i);
   for (int i = 0; i < turns; i++)
     turn_right(edge, cube_edge_i);
 
   return edge;
 }
 
+extern "C" __declspec(dllexport) void quokka_set_render_size(quokka_context* context, int width, int height) { context->set_render_size(width, height); }
+extern "C" __declspec(dllexport) void quokka_set_render_buffers(quokka_context* context, int count) { context->set_render_target_count(count); }
+extern "C" __declspec(dllexport) int quokka_get_render_width(quokka_context* context)  { return context->_renderer.width; }
+extern "C" __declspec(dllexport) int quokka_get_render_height(quokka_context* context) { return context->_renderer.height; }
+
+// unknown modes are ignored
+extern "C" __declspec(dllexport) void quokka_set_render_mode(quokka_context* context, int mode)
+{
+  if (mode >= (int)render_mode::MESH && mode <= (int)render_mode::SKY)
+    context->mode = (render_mode)mode;
+}
+extern "C" __declspec(dllexport) void quokka_set_deferred_shading(quokka_context* context, int enabled) { context->_renderer.deferred = enabled != 0; }
+extern "C" __declspec(dllexport) void quokka_set_lod_target(quokka_context* context, float triangles_per_pixel) { context->_renderer.triangles_per_pixel = triangles_per_pixel; }
+extern "C" __declspec(dllexport) void quokka_set_sky_camera(quokka_context* context, float yaw, float pitch, float fov)
+{
+  context->camera.yaw = yaw;
+  context->camera.pitch = pitch;
+  context->camera.fov = fov;
+}
+
+// unknown formats are ignored
+extern "C" __declspec(dllexport) void quokka_set_frame_format(quokka_context* context, int format)
+{
+  if (is_target_format(format))
+    context->frame_format = (target_format)format;
+}
+
+// non-finite exposures are ignored
+extern "C" __declspec(dllexport) void quokka_set_exposure(quokka_context* context, float exposure)
+{
+  if (std::isfinite(exposure))
+    context->_renderer.exposure = exposure;
+}
+
+extern "C" __declspec(dllexport) pixel* quokka_render(quokka_context* context, float z_angle) { return (pixel*)context->render(z_angle, target_format::RGB32F); }
+// target holds count frames of get_render_width() * get_render_height() pixels,
+// nothing is rendered for an unknown format
+extern "C" __declspec(dllexport) void quokka_render_batch(quokka_context* context, const float* z_angles, int count, void* target, int format)
+{
+  if (is_target_format(format))
+    context->render_batch(z_angles, count, target, (target_format)format);
+}
+
+// same ring as render(), in the format picked with set_frame_format()
+extern "C" __declspec(dllexport) void* quokka_render_frame(quokka_context* context, float z_angle) { return context->render(z_angle, context->frame_format); }
+extern "C" __declspec(dllexport) void quokka_render_to(quokka_context* context, float z_angle, pixel* target) { context->render_to(z_angle, target); }
+extern "C" __declspec(dllexport) void quokka_render_to_rgba8(quokka_context* context, float z_angle, unsigned char* target) { context->render_to(z_angle, target, target_format::RGBA8); }
+extern "C" __declspec(dllexport) void quokka_render_to_srgb8(quokka_context* context, float z_angle, unsigned char* target) { context->render_to(z_angle, target, target_format::RGBA8_SRGB); }
+
+// Variants that return at once and run on the worker pool. Jobs of one
+// context run in the order they were queued, once one is cancelled or fails
+// the jobs queued behind it end as cancelled. The context must not be used
+// otherwise until they are done, except for queueing more jobs. callback may
+// be NULL, it is called on a worker thread once the job has finished and
+// must not call quokka_destroy on the job's context, which would wait for the
+// callback itself. Every returned job has to be released with
+// quokka_job_release.
+extern "C" __declspec(dllexport)
+quokka_job* quokka_open_hdri_async(quokka_context* context, const char* filename, job_callback callback, void* user)
+{
+  std::string name = filename;
+  return context->jobs.push([=](progress_token& progress) { return context->open_hdri(name.c_str(), &progress); },
+    callback, user);
+}
+
+extern "C" __declspec(dllexport)
+quokka_job* quokka_make_cube_async(quokka_context* context, int cube_edge_i, float degrees, job_callback callback, void* user)
+{
+  return context->jobs.push([=](progress_token& progress) { return context->make_cube(cube_edge_i, degrees, &progress); },
+    callback, user);
+}
+
+extern "C" __declspec(dllexport)
+quokka_job* quokka_blur_async(quokka_context* context, int power, job_callback callback, void* user)
+{
+  return context->jobs.push([=](progress_token& progress) { return context->blur(power, &progress); }, callback, user);
+}
+
+extern "C" __declspec(dllexport)
+quokka_job* quokka_save_cube_dds_async(quokka_context* context, const char* filename, int cube_edge_i, job_callback callback, void* user)
+{
+  std::string name = filename;
+  return context->jobs.push([=](progress_token& progress) { return context->save_cube_dds(name.c_str(), cube_edge_i, &progress); },
+    callback, user);
+}
+
+// 0 queued, 1 running, 2 done, 3 cancelled, 4 failed (e.g. unreadable file)
+extern "C" __declspec(dllexport) int quokka_job_poll(quokka_job* job) { return job->poll(); }
+// 0 to 1 over the rows or passes of the running step, 0 while queued
+extern "C" __declspec(dllexport) float quokka_job_progress(quokka_job* job) { return job->fraction(); }
+// a queued job is skipped, a running one stops at its next row or pass and
+// frees its partial buffers: a cancelled make_cube leaves no cube, a
+// cancelled blur the unblurred one and a cancelled save no file
+extern "C" __declspec(dllexport) void quokka_job_cancel(quokka_job* job) { job->cancel(); }
+// 1 once the job has finished, 0 when timeout_ms ran out first, timeout_ms < 0 waits forever
+extern "C" __declspec(dllexport) int quokka_job_wait(quokka_job* job, int timeout_ms) { return job->wait(timeout_ms) ? 1 : 0; }
+extern "C" __declspec(dllexport) void quokka_job_release(quokka_job* job) { job->release(); }
+
+// the exports from before contexts, all on default_context
+extern "C" __declspec(dllexport) void open_hdri(const char* filename) { quokka_open_hdri(&default_context, filename); }
+extern "C" __declspec(dllexport) void make_cube(int cube_edge_i, float degrees) { quokka_make_cube(&default_context, cube_edge_i, degrees); }
+extern "C" __declspec(dllexport) void save_cube_dds(const char* filename, int cube_edge_i) { quokka_save_cube_dds(&default_context, filename, cube_edge_i); }
+extern "C" __declspec(dllexport) void blur(int power) { quokka_blur(&default_context, power); }
+
+extern "C" __declspec(dllexport) quokka_job* open_hdri_async(const char* filename, job_callback callback, void* user)
+{
+  return quokka_open_hdri_async(&default_context, filename, callback, user);
+}
+extern "C" __declspec(dllexport) quokka_job* make_cube_async(int cube_edge_i, float degrees, job_callback callback, void* user)
+{
+  return quokka_make_cube_async(&default_context, cube_edge_i, degrees, callback, user);
+}
+extern "C" __declspec(dllexport) quokka_job* blur_async(int power, job_callback callback, void* user)
+{
+  return quokka_blur_async(&default_context, power, callback, user);
+}
+extern "C" __declspec(dllexport) quokka_job* save_cube_dds_async(const char* filename, int cube_edge_i, job_callback callback, void* user)
+{
+  return quokka_save_cube_dds_async(&default_context, filename, cube_edge_i, callback, user);
+}
+
+extern "C" __declspec(dllexport) int get_width()  { return quokka_get_width(&default_context); }
+extern "C" __declspec(dllexport) int get_height() { return quokka_get_height(&default_context); }
+
+extern "C" __declspec(dllexport) pixel* get_pixels() { return quokka_get_pixels(&default_context); }
+extern "C" __declspec(dllexport) pixel* get_edge(int i) { return quokka_get_edge(&default_context, i); }
+extern "C" __declspec(dllexport) pixel* get_blurred_edge(int i) { return quokka_get_blurred_edge(&default_context, i); }
+extern "C" __declspec(dllexport) pixel* get_edge_t(int i, int turns) { return quokka_get_edge_t(&default_context, i, turns); }
+extern "C" __declspec(dllexport) pixel* get_blurred_edge_t(int i, int turns) { return quokka_get_blurred_edge_t(&default_context, i, turns); }
+
 extern "C" __declspec(dllexport) int get_float_size() { return sizeof(float); }
-extern "C" __declspec(dllexport) void blur(int power) { Singletone.cube.blur(power); }
 
-extern "C" __declspec(dllexport) pixel* render(float z_angle) { return Singletone.render(z_angle); }
+extern "C" __declspec(dllexport) void set_render_size(int width, int height) { quokka_set_render_size(&default_context, width, height); }
+extern "C" __declspec(dllexport) void set_render_buffers(int count) { quokka_set_render_buffers(&default_context, count); }
+extern "C" __declspec(dllexport) int get_render_width()  { return quokka_get_render_width(&default_context); }
+extern "C" __declspec(dllexport) int get_render_height() { return quokka_get_render_height(&default_context); }
+
+extern "C" __declspec(dllexport) void set_render_mode(int mode) { quokka_set_render_mode(&default_context, mode); }
+extern "C" __declspec(dllexport) void set_deferred_shading(int enabled) { quokka_set_deferred_shading(&default_context, enabled); }
+extern "C" __declspec(dllexport) void set_lod_target(float triangles_per_pixel) { quokka_set_lod_target(&default_context, triangles_per_pixel); }
+extern "C" __declspec(dllexport) void set_sky_camera(float yaw, float pitch, float fov) { quokka_set_sky_camera(&default_context, yaw, pitch, fov); }
+
+extern "C" __declspec(dllexport) void set_frame_format(int format) { quokka_set_frame_format(&default_context, format); }
+extern "C" __declspec(dllexport) void set_exposure(float exposure) { quokka_set_exposure(&default_context, exposure); }
+
+extern "C" __declspec(dllexport) pixel* render(float z_angle) { return quokka_render(&default_context, z_angle); }
+extern "C" __declspec(dllexport) void render_batch(const float* z_angles, int count, void* target, int format)
+{
+  quokka_render_batch(&default_context, z_angles, count, target, format);
+}
+extern "C" __declspec(dllexport) void* render_frame(float z_angle) { return quokka_render_frame(&default_context, z_angle); }
+extern "C" __declspec(dllexport) void render_to(float z_angle, pixel* target) { quokka_render_to(&default_context, z_angle, target); }
+extern "C" __declspec(dllexport) void render_to_rgba8(float z_angle, unsigned char* target) { quokka_render_to_rgba8(&default_context, z_angle, target); }
+extern "C" __declspec(dllexport) void render_to_srgb8(float z_angle, unsigned char* target) { quokka_render_to_srgb8(&default_context, z_angle, target); }
 
 
 //{
@@ -227,14 +724,14 @@ int main()
 
   //open_dds("E:\\Work\\hdr_cubemap\\images\\un_Papermill_Ruins_E.dds");
 
-  //Singletone.image.open_hdri("D:\\Stuff\\hdri_cubemap_converter\\glacier.hdr");
+  //default_context.image.open_hdri("D:\\Stuff\\hdri_cubemap_converter\\glacier.hdr");
   //image.open_hdri("E:\\Work\\hdr_cubemap\\images\\glacier.hdr");
 
-  //Singletone.cube.make_cube(Singletone.image.pixels, Singletone.image.width, Singletone.image.height, 256, 0);
+  //default_context.cube.make_cube(default_context.image.pixels, default_context.image.width, default_context.image.height, 256, 0);
 
   //cube.blur(30);
 
-  //Singletone.render();
+  //default_context.render();
     
   //cube.turn_right(Surface::X_P);
   //cube.turn_right(Surface::X_P);
@@ -244,7 +741,7 @@ int main()
   //cube.turn_right(Surface::Y_P);
   //
   //
-  //write_dds_cubemap("E:\\Work\\hdr_cubemap\\images\\output.dds", Singletone.cube.edges, 256);
+  //write_dds_cubemap("E:\\Work\\hdr_cubemap\\images\\output.dds", default_context.cube.edges, 256);
   //write_dds_cubemap("D:\\Stuff\\hdri_cubemap_converter\\output.dds", cube.edges, 256);
 
   //open_hdri("E:\\Work\\hdr_cubemap\\images\\grace-new.hdr");
@@ -0,0 +1,644 @@
+#include "big_quokka.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#if QUOKKA_HAS_TSC && !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace quokka
+{
+  template<> STDChronoTimer* Singletone<STDChronoTimer>::Instance = NULL;
+  // created up front so GetInstance never races, construction only reads
+  // cpuid and calibration waits for the first timestamp
+  template<> HighResolutionTimer* Singletone<HighResolutionTimer>::Instance = new HighResolutionTimer();
+  template<> Profiler* Singletone<Profiler>::Instance = new Profiler();
+
+  thread_local Profiler::ThreadData* Profiler::LocalData = nullptr;
+
+  Profiler* GProfiler() { return Profiler::GetInstance(); }
+
+#if QUOKKA_HAS_TSC
+  static void Cpuid(unsigned int Leaf, unsigned int Regs[4])
+  {
+#ifdef _MSC_VER
+    int Out[4];
+    __cpuid(Out, (int)Leaf);
+    for (int i = 0; i < 4; i++) Regs[i] = (unsigned int)Out[i];
+#else
+    __cpuid(Leaf, Regs[0], Regs[1], Regs[2], Regs[3]);
+#endif
+  }
+#endif
+
+  HighResolutionTimer::HighResolutionTimer()
+  {
+#if QUOKKA_HAS_TSC
+    unsigned int Regs[4];
+    Cpuid(0x80000000u, Regs);
+    unsigned int MaxExtended = Regs[0];
+    if (MaxExtended >= 0x80000001u)
+    {
+      Cpuid(0x80000001u, Regs);
+      HasRdtscp = (Regs[3] >> 27) & 1;
+    }
+    if (MaxExtended >= 0x80000007u)
+    {
+      // invariant TSC: constant rate across P-states and C-states
+      Cpuid(0x80000007u, Regs);
+      UseTsc = (Regs[3] >> 8) & 1;
+    }
+#endif
+  }
+
+  void HighResolutionTimer::CalibrateOnce()
+  {
+    std::call_once(CalibrationFlag, [this]
+    {
+      if (UseTsc)
+        Calibrate();
+      ChronoStart = std::chrono::steady_clock::now();
+      Calibrated.store(true, std::memory_order_release);
+    });
+  }
+
+  // ticks over a couple of milliseconds of the monotonic clock, which is
+  // clock_gettime(CLOCK_MONOTONIC) on Linux and QueryPerformanceCounter on
+  // Windows
+  void HighResolutionTimer::Calibrate()
+  {
+    typedef std::chrono::steady_clock Clock;
+    const std::chrono::nanoseconds Window = std::chrono::milliseconds(2);
+
+    Clock::time_point Begin = Clock::now();
+    uint64 BeginTicks = rdtsc();
+    Clock::time_point End;
+    do
+    {
+      End = Clock::now();
+    } while (End - Begin < Window);
+    uint64 EndTicks = rdtsc();
+
+    long long Nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(End - Begin).count();
+    if (EndTicks <= BeginTicks || Nanoseconds <= 0)
+    {
+      UseTsc = false;
+      return;
+    }
+
+    NanosecondsPerTick = double(Nanoseconds) / double(EndTicks - BeginTicks);
+    Start = rdtsc();
+  }
+
+  ProfilerScopeId Profiler::Intern(const char* Name)
+  {
+    std::lock_guard<std::mutex> Lock(InternLock);
+
+    std::map<std::string, ProfilerScopeId>::iterator it = Ids.find(Name);
+    if (it != Ids.end())
+      return it->second;
+
+    ProfilerScopeId Id = ScopeCount < MAX_SCOPES ? ScopeCount++ : MAX_SCOPES - 1;
+    it = Ids.insert(std::make_pair(std::string(Name), Id)).first;
+    if (!Names[Id])
+      Names[Id] = it->first.c_str();
+    return Id;
+  }
+
+  // buffers live as long as the profiler, so results of finished threads stay
+  // in the report
+  Profiler::ThreadData* Profiler::RegisterThread()
+  {
+    ThreadData* Data = new ThreadData();
+    Data->ThreadIndex = ThreadCount.fetch_add(1);
+
+    ThreadData* Head = Threads.load(std::memory_order_relaxed);
+    do
+    {
+      Data->Next = Head;
+    } while (!Threads.compare_exchange_weak(Head, Data, std::memory_order_release, std::memory_order_relaxed));
+
+    LocalData = Data;
+    return Data;
+  }
+
+  // first call of a scope under this parent, the node is filled in before
+  // NodeCount publishes it
+  int Profiler::AddNode(ThreadData* Data, ProfilerScopeId Id, int Parent)
+  {
+    int* Link = Parent < 0 ? &Data->RootFirstChild : &Data->Nodes[Parent].FirstChild;
+    int Node = *Link;
+    while (Node >= 0 && Data->Nodes[Node].Id != Id)
+      Node = Data->Nodes[Node].NextSibling;
+
+    if (Node < 0)
+    {
+      int Count = Data->NodeCount.load(std::memory_order_relaxed);
+      if (Count == MAX_NODES)
+        return -1;
+
+      Node = Count;
+      ProfilerNode& Fresh = Data->Nodes[Node];
+      Fresh.Id = Id;
+      Fresh.Parent = Parent;
+      Fresh.NextSibling = *Link;
+      *Link = Node;
+      Data->NodeCount.store(Count + 1, std::memory_order_release);
+    }
+
+    ProfilerStamp& Stamp = Data->Stamps[Id];
+    Stamp.CachedParent = Parent;
+    Stamp.CachedNode = Node;
+    return Node;
+  }
+
+  ProfilerHistogram* Profiler::AddHistogram(ProfilerStamp& Stamp)
+  {
+    ProfilerHistogram* Histogram = new ProfilerHistogram();
+    Stamp.Histogram.store(Histogram, std::memory_order_release);
+    return Histogram;
+  }
+
+#ifdef __linux__
+  static int OpenCounter(unsigned int Type, uint64 Config, int Group)
+  {
+    perf_event_attr Attr;
+    memset(&Attr, 0, sizeof(Attr));
+    Attr.size = sizeof(Attr);
+    Attr.type = Type;
+    Attr.config = Config;
+    Attr.disabled = Group < 0 ? 1 : 0;
+    Attr.exclude_kernel = 1;
+    Attr.exclude_hv = 1;
+    Attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(__NR_perf_event_open, &Attr, 0, -1, Group, 0);
+  }
+#endif
+
+  // cycles lead the group, a sibling the PMU does not offer is left out and
+  // reads as zero
+  static bool OpenCounters(Profiler::ThreadData* Data)
+  {
+#ifdef __linux__
+    static const uint64 Configs[COUNTER_COUNT] =
+    {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    int Group = OpenCounter(PERF_TYPE_HARDWARE, Configs[0], -1);
+    if (Group < 0)
+      return false;
+
+    Data->CounterGroup = Group;
+    Data->CounterFds[0] = Group;
+    Data->CounterSlots[0] = 0;
+    int Members = 1;
+    for (int c = 1; c < COUNTER_COUNT; c++)
+    {
+      int Fd = OpenCounter(PERF_TYPE_HARDWARE, Configs[c], Group);
+      if (Fd < 0)
+        continue;
+      Data->CounterFds[c] = Fd;
+      Data->CounterSlots[c] = Members++;
+    }
+
+    ioctl(Group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(Group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+#else
+    (void)Data;
+    return false;
+#endif
+  }
+
+  bool Profiler::SetHardwareCounters(bool Enabled)
+  {
+    Counting.store(Enabled);
+    if (!Enabled)
+      return false;
+
+    uint64 Values[COUNTER_COUNT];
+    return ReadCounters(Local(), Values);
+  }
+
+  bool Profiler::ReadCounters(ThreadData* Data, uint64* Values)
+  {
+    if (Data->CounterState == 0)
+      Data->CounterState = OpenCounters(Data) ? 1 : -1;
+    if (Data->CounterState < 0)
+      return false;
+
+#ifdef __linux__
+    // member count, time enabled, time running, then one value per member
+    uint64 Buffer[3 + COUNTER_COUNT];
+    if (read(Data->CounterGroup, Buffer, sizeof(Buffer)) < (ssize_t)(3 * sizeof(uint64)))
+      return false;
+
+    // when the kernel multiplexes the PMU the group only counts part of the
+    // time, the values are scaled up to the whole time it was enabled
+    uint64 Enabled = Buffer[1];
+    uint64 Running = Buffer[2];
+    double Scale = Running > 0 ? double(Enabled) / double(Running) : 0.0;
+    for (int c = 0; c < COUNTER_COUNT; c++)
+    {
+      int Slot = Data->CounterSlots[c];
+      uint64 Raw = Slot >= 0 && (uint64)Slot < Buffer[0] ? Buffer[3 + Slot] : 0;
+      Values[c] = Running == Enabled ? Raw : (uint64)(double(Raw) * Scale);
+    }
+    return true;
+#else
+    (void)Values;
+    return false;
+#endif
+  }
+
+  void Profiler::AddCounters(ThreadData* Data, const Frame& Top)
+  {
+    uint64 Values[COUNTER_COUNT];
+    if (!ReadCounters(Data, Values))
+      return;
+
+    ProfilerStamp& Stamp = Data->Stamps[Top.Id];
+    for (int c = 0; c < COUNTER_COUNT; c++)
+      Add(Stamp.Counters[c], Values[c] - Top.Counters[c]);
+  }
+
+  void Profiler::AddTraceEvent(ThreadData* Data, ProfilerScopeId Id, uint64 Begin, uint64 End)
+  {
+    TraceChunk* Chunk = Data->TraceTail;
+    int Count = Chunk ? Chunk->Count.load(std::memory_order_relaxed) : TraceChunk::SIZE;
+    if (Count == TraceChunk::SIZE)
+    {
+      if (Data->TraceChunkCount == MAX_TRACE_CHUNKS)
+        return;
+
+      TraceChunk* Fresh = new TraceChunk();
+      if (Chunk)
+        Chunk->Next.store(Fresh, std::memory_order_release);
+      else
+        Data->TraceHead.store(Fresh, std::memory_order_release);
+      Data->TraceTail = Chunk = Fresh;
+      Data->TraceChunkCount++;
+      Count = 0;
+    }
+
+    TraceEvent& Event = Chunk->Events[Count];
+    Event.Begin = Begin;
+    Event.End = End;
+    Event.Id = Id;
+    Event.Depth = Data->Depth;
+    Chunk->Count.store(Count + 1, std::memory_order_release);
+  }
+
+  // scope names are arbitrary strings, quotes and backslashes are escaped and
+  // control characters dropped to spaces
+  static std::string JsonEscape(const char* Text)
+  {
+    std::string Out;
+    for (const char* c = Text; *c; c++)
+    {
+      if (*c == '"' || *c == '\\') { Out += '\\'; Out += *c; }
+      else if ((unsigned char)*c < 0x20) Out += ' ';
+      else Out += *c;
+    }
+    return Out;
+  }
+
+  // Chrome trace event format, one complete ("X") event per scope, times in
+  // microseconds. Nesting follows from the times, depth is kept in args.
+  bool Profiler::WriteChromeTrace(const char* Filename)
+  {
+    FILE* File = nullptr;
+    if (fopen_s(&File, Filename, "w") != 0 || !File)
+      return false;
+
+    std::vector<std::string> ScopeNames(MAX_SCOPES);
+    {
+      std::lock_guard<std::mutex> Lock(InternLock);
+      for (int i = 0; i < MAX_SCOPES; i++)
+        ScopeNames[i] = JsonEscape(Names[i] ? Names[i] : "?");
+    }
+
+    fprintf(File, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    const char* Separator = "\n";
+    for (ThreadData* Data = Threads.load(std::memory_order_acquire); Data; Data = Data->Next)
+    {
+      fprintf(File, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+        Separator, Data->ThreadIndex, Data->ThreadIndex);
+      Separator = ",\n";
+
+      for (TraceChunk* Chunk = Data->TraceHead.load(std::memory_order_acquire); Chunk; Chunk = Chunk->Next.load(std::memory_order_acquire))
+      {
+        int Count = Chunk->Count.load(std::memory_order_acquire);
+        for (int i = 0; i < Count; i++)
+        {
+          const TraceEvent& Event = Chunk->Events[i];
+          fprintf(File, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%d}}",
+            Separator, ScopeNames[Event.Id].c_str(), Data->ThreadIndex, Event.Begin / 1000.0, (Event.End - Event.Begin) / 1000.0, Event.Depth);
+        }
+      }
+    }
+    fprintf(File, "\n]}\n");
+
+    bool Ok = !ferror(File);
+    fclose(File);
+    return Ok;
+  }
+
+  int Profiler::CollectFrameTimes(uint64* Out, int Capacity)
+  {
+    uint64 Count = FrameCount.load(std::memory_order_relaxed);
+    uint64 Available = std::min<uint64>(Count, MAX_FRAMES);
+    int Written = (int)std::min<uint64>(Available, Capacity > 0 ? (uint64)Capacity : 0);
+    uint64 First = Count - Written;
+    for (int i = 0; i < Written; i++)
+      Out[i] = FrameTimes[(First + i) % MAX_FRAMES].load(std::memory_order_relaxed);
+    return Written;
+  }
+
+  void Profiler::Reset()
+  {
+    for (ThreadData* Data = Threads.load(std::memory_order_acquire); Data; Data = Data->Next)
+    {
+      for (int i = 0; i < MAX_SCOPES; i++)
+      {
+        ProfilerStamp& Stamp = Data->Stamps[i];
+        Stamp.Sum.store(0, std::memory_order_relaxed);
+        Stamp.Count.store(0, std::memory_order_relaxed);
+        Stamp.Min.store(~0ull, std::memory_order_relaxed);
+        Stamp.Max.store(0, std::memory_order_relaxed);
+        for (int c = 0; c < COUNTER_COUNT; c++)
+          Stamp.Counters[c].store(0, std::memory_order_relaxed);
+
+        ProfilerHistogram* Histogram = Stamp.Histogram.load(std::memory_order_acquire);
+        if (Histogram)
+          for (int b = 0; b < ProfilerHistogram::BUCKETS; b++)
+            Histogram->Counts[b].store(0, std::memory_order_relaxed);
+      }
+
+      int NodeCount = Data->NodeCount.load(std::memory_order_acquire);
+      for (int n = 0; n < NodeCount; n++)
+      {
+        ProfilerNode& Node = Data->Nodes[n];
+        Node.Sum.store(0, std::memory_order_relaxed);
+        Node.ChildSum.store(0, std::memory_order_relaxed);
+        Node.Count.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    for (int i = 0; i < MAX_FRAMES; i++)
+      FrameTimes[i].store(0, std::memory_order_relaxed);
+    FrameCount.store(0, std::memory_order_relaxed);
+  }
+
+  static uint64 Percentile(const std::vector<uint64>& Counts, uint64 Total, double Fraction)
+  {
+    uint64 Target = (uint64)std::ceil(Fraction * Total);
+    if (Target == 0)
+      Target = 1;
+
+    uint64 Seen = 0;
+    for (int i = 0; i < ProfilerHistogram::BUCKETS; i++)
+    {
+      Seen += Counts[i];
+      if (Seen >= Target)
+      {
+        uint64 Low = ProfilerHistogram::BucketLow(i);
+        uint64 High = i + 1 < ProfilerHistogram::BUCKETS ? ProfilerHistogram::BucketLow(i + 1) : Low;
+        return Low + (High - Low) / 2;
+      }
+    }
+    return 0;
+  }
+
+  void Profiler::Collect(std::vector<ProfilerTotal>& Out, int ThreadIndex)
+  {
+    int Count;
+    {
+      std::lock_guard<std::mutex> Lock(InternLock);
+      Count = ScopeCount;
+    }
+
+    std::vector<ProfilerTotal> Totals(Count);
+    std::vector<uint64> Buckets((size_t)Count * ProfilerHistogram::BUCKETS, 0);
+    for (int i = 0; i < Count; i++)
+    {
+      Totals[i].Name = Names[i];
+      Totals[i].Min = ~0ull;
+    }
+
+    for (ThreadData* Data = Threads.load(std::memory_order_acquire); Data; Data = Data->Next)
+    {
+      if (ThreadIndex >= 0 && Data->ThreadIndex != ThreadIndex)
+        continue;
+
+      for (int i = 0; i < Count; i++)
+      {
+        const ProfilerStamp& Stamp = Data->Stamps[i];
+        ProfilerTotal& Total = Totals[i];
+        Total.Sum += Stamp.Sum.load(std::memory_order_relaxed);
+        Total.Count += Stamp.Count.load(std::memory_order_relaxed);
+        Total.Min = std::min(Total.Min, Stamp.Min.load(std::memory_order_relaxed));
+        Total.Max = std::max(Total.Max, Stamp.Max.load(std::memory_order_relaxed));
+        for (int c = 0; c < COUNTER_COUNT; c++)
+        {
+          Total.Counters[c] += Stamp.Counters[c].load(std::memory_order_relaxed);
+          Total.HasCounters |= Total.Counters[c] != 0;
+        }
+
+        const ProfilerHistogram* Histogram = Stamp.Histogram.load(std::memory_order_acquire);
+        if (Histogram)
+        {
+          uint64* Merged = &Buckets[(size_t)i * ProfilerHistogram::BUCKETS];
+          for (int b = 0; b < ProfilerHistogram::BUCKETS; b++)
+            Merged[b] += Histogram->Counts[b].load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    Out.clear();
+    std::vector<uint64> Counts(ProfilerHistogram::BUCKETS);
+    for (int i = 0; i < Count; i++)
+    {
+      ProfilerTotal& Total = Totals[i];
+      if (!Total.Count)
+        continue;
+
+      Counts.assign(Buckets.begin() + (size_t)i * ProfilerHistogram::BUCKETS, Buckets.begin() + (size_t)(i + 1) * ProfilerHistogram::BUCKETS);
+      uint64 Recorded = 0;
+      for (uint64 c : Counts)
+        Recorded += c;
+      if (Recorded)
+      {
+        // a bucket midpoint can lie past the largest sample
+        Total.P50 = std::min(Percentile(Counts, Recorded, 0.50), Total.Max);
+        Total.P90 = std::min(Percentile(Counts, Recorded, 0.90), Total.Max);
+        Total.P99 = std::min(Percentile(Counts, Recorded, 0.99), Total.Max);
+      }
+      Out.push_back(Total);
+    }
+  }
+
+  // thread trees are merged by call path: a node maps to the merged child of
+  // its parent's merged node with the same scope
+  void Profiler::CollectTree(std::vector<ProfilerTreeNode>& Out, int ThreadIndex)
+  {
+    struct MergedNode
+    {
+      ProfilerScopeId Id;
+      int Parent;
+      uint64 Sum = 0;
+      uint64 ChildSum = 0;
+      uint64 Count = 0;
+      std::vector<int> Children;
+    };
+    std::vector<MergedNode> Merged;
+    std::map<std::pair<int, ProfilerScopeId>, int> Lookup;
+    std::vector<int> Roots;
+
+    for (ThreadData* Data = Threads.load(std::memory_order_acquire); Data; Data = Data->Next)
+    {
+      if (ThreadIndex >= 0 && Data->ThreadIndex != ThreadIndex)
+        continue;
+
+      // parents are always created before their children
+      int NodeCount = Data->NodeCount.load(std::memory_order_acquire);
+      std::vector<int> ToMerged(NodeCount);
+      for (int n = 0; n < NodeCount; n++)
+      {
+        const ProfilerNode& Node = Data->Nodes[n];
+        int Parent = Node.Parent < 0 ? -1 : ToMerged[Node.Parent];
+
+        std::pair<int, ProfilerScopeId> Key(Parent, Node.Id);
+        std::map<std::pair<int, ProfilerScopeId>, int>::iterator it = Lookup.find(Key);
+        int Index;
+        if (it == Lookup.end())
+        {
+          Index = (int)Merged.size();
+          MergedNode Fresh;
+          Fresh.Id = Node.Id;
+          Fresh.Parent = Parent;
+          Merged.push_back(Fresh);
+          Lookup[Key] = Index;
+          if (Parent < 0)
+            Roots.push_back(Index);
+          else
+            Merged[Parent].Children.push_back(Index);
+        }
+        else
+        {
+          Index = it->second;
+        }
+
+        ToMerged[n] = Index;
+        Merged[Index].Sum += Node.Sum.load(std::memory_order_relaxed);
+        Merged[Index].ChildSum += Node.ChildSum.load(std::memory_order_relaxed);
+        Merged[Index].Count += Node.Count.load(std::memory_order_relaxed);
+      }
+    }
+
+    const char* ScopeNames[MAX_SCOPES];
+    {
+      std::lock_guard<std::mutex> Lock(InternLock);
+      std::copy(Names, Names + MAX_SCOPES, ScopeNames);
+    }
+
+    // depth-first, children ordered by inclusive time
+    Out.clear();
+    std::vector<std::pair<int, int>> Pending;   // merged index, parent in Out
+    for (int i = (int)Roots.size() - 1; i >= 0; i--)
+      Pending.push_back(std::make_pair(Roots[i], -1));
+    std::sort(Pending.begin(), Pending.end(), [&](const std::pair<int, int>& a, const std::pair<int, int>& b)
+    {
+      return Merged[a.first].Sum < Merged[b.first].Sum;
+    });
+
+    while (!Pending.empty())
+    {
+      std::pair<int, int> Next = Pending.back();
+      Pending.pop_back();
+      const MergedNode& Node = Merged[Next.first];
+
+      ProfilerTreeNode Entry;
+      Entry.Name = ScopeNames[Node.Id];
+      Entry.Parent = Next.second;
+      Entry.Depth = Next.second < 0 ? 0 : Out[Next.second].Depth + 1;
+      Entry.Sum = Node.Sum;
+      Entry.Self = Node.Sum > Node.ChildSum ? Node.Sum - Node.ChildSum : 0;
+      Entry.Count = Node.Count;
+      int Position = (int)Out.size();
+      Out.push_back(Entry);
+
+      std::vector<int> Children = Node.Children;
+      std::sort(Children.begin(), Children.end(), [&](int a, int b) { return Merged[a].Sum < Merged[b].Sum; });
+      for (int Child : Children)
+        Pending.push_back(std::make_pair(Child, Position));
+    }
+  }
+
+  void Profiler::Report(int ThreadIndex)
+  {
+    std::vector<ProfilerTotal> Totals;
+    Collect(Totals, ThreadIndex);
+    print_out("\n%20s : %12s %10s %10s %10s %10s %10s", "scope", "total us", "calls", "p50", "p90", "p99", "max");
+    for (const ProfilerTotal& Total : Totals)
+      print_out("\n%20s : %12.1f %10llu %10.1f %10.1f %10.1f %10.1f", Total.Name, Total.Sum / 1000.0, Total.Count,
+        Total.P50 / 1000.0, Total.P90 / 1000.0, Total.P99 / 1000.0, Total.Max / 1000.0);
+
+    bool HasCounters = false;
+    for (const ProfilerTotal& Total : Totals)
+      HasCounters |= Total.HasCounters;
+    if (HasCounters)
+    {
+      print_out("\n%20s : %14s %14s %6s %12s %12s", "scope", "cycles", "instructions", "ipc", "llc misses", "br misses");
+      for (const ProfilerTotal& Total : Totals)
+      {
+        if (!Total.HasCounters)
+          continue;
+        const uint64* c = Total.Counters;
+        double Ipc = c[COUNTER_CYCLES] ? double(c[COUNTER_INSTRUCTIONS]) / c[COUNTER_CYCLES] : 0.0;
+        print_out("\n%20s : %14llu %14llu %6.2f %12llu %12llu", Total.Name, c[COUNTER_CYCLES], c[COUNTER_INSTRUCTIONS], Ipc,
+          c[COUNTER_LLC_MISSES], c[COUNTER_BRANCH_MISSES]);
+      }
+    }
+
+    std::vector<ProfilerTreeNode> Tree;
+    CollectTree(Tree, ThreadIndex);
+    print_out("\n%-32s %12s %12s %10s", "call tree", "incl us", "self us", "calls");
+    for (const ProfilerTreeNode& Node : Tree)
+    {
+      int Indent = std::min(Node.Depth * 2, 24);
+      print_out("\n%*s%-*s %12.1f %12.1f %10llu", Indent, "", 32 - Indent, Node.Name, Node.Sum / 1000.0, Node.Self / 1000.0, Node.Count);
+    }
+  }
+
+  void Profiler::Print()
+  {
+    Report(-1);
+  }
+
+  void Profiler::PrintThreads()
+  {
+    std::vector<ProfilerTotal> Totals;
+    for (int t = 0; t < GetThreadCount(); t++)
+    {
+      Collect(Totals, t);
+      if (Totals.empty())
+        continue;
+
+      print_out("\nthread %d", t);
+      Report(t);
+    }
+  }
+}
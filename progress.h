@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+
+// How far a long operation has got and whether it should stop, shared
+// between the thread doing the work and whoever watches it. The work adds
+// its total when it starts and steps at row or pass granularity, checking
+// for cancellation at the same points. A cancelled operation frees what it
+// allocated and returns false.
+struct progress_token
+{
+  std::atomic<long long> done{ 0 };
+  std::atomic<long long> total{ 0 };
+  std::atomic<bool> cancel_requested{ false };
+
+  void cancel() { cancel_requested.store(true, std::memory_order_relaxed); }
+  bool cancelled() const { return cancel_requested.load(std::memory_order_relaxed); }
+
+  // 0 until the work has announced its total
+  float fraction() const
+  {
+    long long t = total.load(std::memory_order_relaxed);
+    long long d = done.load(std::memory_order_relaxed);
+    return t > 0 ? (d < t ? float(d) / float(t) : 1.f) : 0.f;
+  }
+};
+
+// both take a null token, for callers that don't watch the work
+
+inline void progress_begin(progress_token* progress, long long amount)
+{
+  if (progress)
+    progress->total.fetch_add(amount, std::memory_order_relaxed);
+}
+
+// false once cancellation was requested
+inline bool progress_step(progress_token* progress, long long amount = 1)
+{
+  if (!progress)
+    return true;
+  progress->done.fetch_add(amount, std::memory_order_relaxed);
+  return !progress->cancelled();
+}
@@ -1,25 +1,380 @@
 #include "renderer.h"
 #include "big_quokka.h"
+#include "MemoryTracker.h"
+#include "sky_sphere.h"
+#include "texture.h"
+#include "worker_pool.h"
 
-void renderer::clear_z()
+#include <emmintrin.h>
+#include <float.h>
+#include <string.h>
+
+static constexpr sky_sphere_mesh<SKY_SPHERE_TESSELLATION> sky_sphere = sky_sphere_mesh<SKY_SPHERE_TESSELLATION>();
+
+void model::from_sky_sphere(bool inverted)
+{
+  // on the unit sphere a vertex is its own outward normal
+  verts = sky_sphere.verts;
+  normals = sky_sphere.verts;
+  uvs = sky_sphere.uvs;
+  vert_count = sky_sphere.VERT_COUNT;
+
+  faces.resize(sky_sphere.FACE_COUNT);
+  for (int i = 0; i < sky_sphere.FACE_COUNT; i++)
+  {
+    const int* tri = &sky_sphere.indices[i * 3];
+    int i2 = inverted ? tri[2] : tri[1];
+    int i3 = inverted ? tri[1] : tri[2];
+
+    face& f = faces[i];
+    f.v1 = f.t1 = f.n1 = tri[0];
+    f.v2 = f.t2 = f.n2 = i2;
+    f.v3 = f.t3 = f.n3 = i3;
+  }
+
+  // coarser levels keep every step-th grid line of each face, so they reuse
+  // the same vertices and uvs
+  const int N = SKY_SPHERE_TESSELLATION;
+  const int side = sky_sphere.SIDE;
+  std::vector<std::vector<face>> coarser_lods;
+  for (int step = 2; step <= N && N % step == 0; step *= 2)
+  {
+    std::vector<face> level;
+    level.reserve(6 * (N / step) * (N / step) * 2);
+    for (int f = 0; f < 6; f++)
+    {
+      bool front = cube_strip_face_outward(f) != inverted;
+      for (int t = 0; t < N; t += step)
+      {
+        for (int s = 0; s < N; s += step)
+        {
+          int a = f * side * side + t * side + s;
+          int b = a + step;
+          int c = a + step * side + step;
+          int d = a + step * side;
+
+          face f1, f2;
+          f1.v1 = f1.t1 = f1.n1 = a;
+          f1.v2 = f1.t2 = f1.n2 = front ? b : c;
+          f1.v3 = f1.t3 = f1.n3 = front ? c : b;
+          f2.v1 = f2.t1 = f2.n1 = a;
+          f2.v2 = f2.t2 = f2.n2 = front ? c : d;
+          f2.v3 = f2.t3 = f2.n3 = front ? d : c;
+          level.push_back(f1);
+          level.push_back(f2);
+        }
+      }
+    }
+    coarser_lods.push_back(level);
+  }
+
+  prepare(coarser_lods);
+}
+
+void model::prepare(const std::vector<std::vector<face>>& coarser_lods)
+{
+  lods.resize(1 + coarser_lods.size());
+  lods[0].faces = faces;
+  for (size_t l = 0; l < coarser_lods.size(); l++)
+    lods[l + 1].faces = coarser_lods[l];
+
+  for (lod_level& level : lods)
+  {
+    int face_count = (int)level.faces.size();
+    level.face_normals.resize(face_count);
+
+    for (int i = 0; i < face_count; i++)
+    {
+      const face& f = level.faces[i];
+      vec3 e1 = verts[f.v2] - verts[f.v1];
+      vec3 e2 = verts[f.v3] - verts[f.v1];
+
+      // vec3::cross negates z, spelled out here
+      vec3 normal = { e1.y*e2.z - e1.z*e2.y, e1.z*e2.x - e1.x*e2.z, e1.x*e2.y - e1.y*e2.x };
+      float length = normal.length();
+      level.face_normals[i] = length > 0 ? normal / length : normal;
+    }
+  }
+
+  radius = 0.f;
+  for (int i = 0; i < vert_count; i++)
+    radius = std::max(radius, verts[i].length());
+
+  revision++;
+}
+
+void model_instance::update(const model& m, float scale, const mat3x3& rot_z, vec3 light, int a_lod)
+{
+  if (a_lod >= (int)m.lods.size()) a_lod = (int)m.lods.size() - 1;
+  if (a_lod < 0) a_lod = 0;
+
+  if (valid &&
+    lod == a_lod &&
+    model_revision == m.revision &&
+    cached_scale == scale &&
+    memcmp(&cached_rot_z, &rot_z, sizeof(mat3x3)) == 0 &&
+    cached_light.x == light.x && cached_light.y == light.y && cached_light.z == light.z)
+    return;
+
+  mat3x3 rot = rot_z;
+
+  int vert_count = m.vert_count;
+  transformed.resize(vert_count);
+  const vec3* src = m.verts;
+  vec3* dst = transformed.data();
+  for (int i = 0; i < vert_count; i++)
+    dst[i] = rot * (src[i] * scale);
+
+  // a uniform scale keeps normals, so only the rotation is applied
+  const model::lod_level* level = m.lods.empty() ? nullptr : &m.lods[a_lod];
+  int face_count = level ? (int)level->face_normals.size() : 0;
+  visible_faces.clear();
+  visible_intensity.clear();
+  visible_faces.reserve(face_count);
+  visible_intensity.reserve(face_count);
+
+  const vec3* normals = level ? level->face_normals.data() : nullptr;
+  for (int i = 0; i < face_count; i++)
+  {
+    vec3 normal = rot * normals[i];
+    float intensity = vec3::dot(normal, light);
+    if (intensity > 0)
+    {
+      visible_faces.push_back(i);
+      visible_intensity.push_back(intensity);
+    }
+  }
+
+  valid = true;
+  lod = a_lod;
+  model_revision = m.revision;
+  cached_scale = scale;
+  cached_rot_z = rot_z;
+  cached_light = light;
+}
+
+void renderer::release()
 {
+  quokka::UntrackAllocation(color);
+  quokka::UntrackAllocation(z_buffer);
+  quokka::UntrackAllocation(gbuffer);
+  _mm_free(color);
+  _mm_free(z_buffer);
+  _mm_free(gbuffer);
+  color = nullptr;
+  z_buffer = nullptr;
+  gbuffer = nullptr;
+}
+
+// buffers are 64 byte aligned so a tile row never straddles more cache lines
+// than it has to and the clears can use aligned stores
+void renderer::allocate()
+{
+  tiles_x = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+  tiles_y = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+
+  quokka::MemoryTagScope tag(quokka::MEMORY_TAG_RENDER);
+  if (!color)
+  {
+    color = (pixel*)_mm_malloc(sizeof(pixel) * padded_pixels(), 64);
+    quokka::TrackAllocation(color, sizeof(pixel) * padded_pixels());
+  }
   if (!z_buffer)
-    z_buffer = new float[width*height];
-  for (int i = 0; i < width*height; i++)
-    z_buffer[i] = -FLT_MAX;
-    //memset(z_buffer, 255, sizeof(float)*width*height);
+  {
+    z_buffer = (float*)_mm_malloc(sizeof(float) * padded_pixels(), 64);
+    quokka::TrackAllocation(z_buffer, sizeof(float) * padded_pixels());
+  }
+  if (deferred && !gbuffer)
+  {
+    gbuffer = (gbuffer_sample*)_mm_malloc(sizeof(gbuffer_sample) * padded_pixels(), 64);
+    quokka::TrackAllocation(gbuffer, sizeof(gbuffer_sample) * padded_pixels());
+  }
 }
 
-void renderer::triangle(face& f, model& m, pixel* image, float intensity)
-{  
-  vec3 verts[3] = { m.verts[f.v1], m.verts[f.v2], m.verts[f.v3] };
+void renderer::resize(int a_width, int a_height)
+{
+  if (a_width == width && a_height == height)
+    return;
+
+  width = a_width;
+  height = a_height;
+
+  release();
+}
+
+void renderer::clear()
+{
+  allocate();
+
+  // padded_pixels() is a multiple of 64, so the float count is a multiple of 4
+  float* dst = (float*)color;
+  int count = padded_pixels() * 3;
+  __m128 zero = _mm_setzero_ps();
+  for (int i = 0; i < count; i += 4)
+    _mm_store_ps(dst + i, zero);
+}
+
+void renderer::clear_z()
+{
+  allocate();
 
-  // transformation
-  //for (vec3 &v : verts)
-  //{
-  //  v = v * m.scale;
-  //  v = m.rot_z*v;
-  //}
+  __m128 far_z = _mm_set1_ps(-FLT_MAX);
+  int count = padded_pixels();
+  for (int i = 0; i < count; i += 4)
+    _mm_store_ps(z_buffer + i, far_z);
+
+  sources.clear();
+  if (deferred)
+  {
+    for (int i = 0; i < count; i++)
+      gbuffer[i].source = -1;
+  }
+}
+
+static inline pixel shade(const model& m, float u, float v, float intensity, float lod)
+{
+  // both are empty before the first make_cube and after a cancelled one
+  if (m.texture && !m.texture->empty())
+    return m.texture->fetch(m.texture->pick_level(lod), u, v) * intensity;
+
+  if (!m.diffuse || m.d_width <= 0 || m.d_height <= 0)
+    return pixel(intensity, intensity, intensity);
+
+  int dif_index = int(m.d_width*u) + m.d_width*int(m.d_height*v);
+  if (dif_index < 0) dif_index = 0;
+  if (dif_index >= m.d_width*m.d_height) dif_index = m.d_width*m.d_height - 1;
+  return m.diffuse[dif_index] * intensity;
+}
+
+void renderer::resolve_deferred()
+{
+  global_worker_pool().parallel_for(tiles_y, 2, [&](int tile_row_begin, int tile_row_end)
+  {
+    int begin = tile_row_begin * tiles_x * TILE_PIXELS;
+    int end = tile_row_end * tiles_x * TILE_PIXELS;
+    for (int i = begin; i < end; i++)
+    {
+      const gbuffer_sample& sample = gbuffer[i];
+      color[i] = sample.source < 0 ? pixel() : shade(*sources[sample.source], sample.u, sample.v, sample.intensity, sample.lod);
+    }
+  });
+}
+
+static inline unsigned char to_unorm8(float v)
+{
+  return v >= 1.f ? 255 : v <= 0.f ? 0 : (unsigned char)(v * 255.f + 0.5f);
+}
+
+// linear [0, 1) to sRGB bytes, indexed by value * (SRGB_LUT_SIZE - 1)
+static const int SRGB_LUT_SIZE = 4096;
+
+static const unsigned char* srgb_lut()
+{
+  static unsigned char lut[SRGB_LUT_SIZE];
+  static bool initialized = [] {
+    for (int i = 0; i < SRGB_LUT_SIZE; i++)
+    {
+      float v = float(i) / (SRGB_LUT_SIZE - 1);
+      float s = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.f / 2.4f) - 0.055f;
+      lut[i] = (unsigned char)(s * 255.f + 0.5f);
+    }
+    return true;
+  }();
+  (void)initialized;
+  return lut;
+}
+
+// exposure and Reinhard do not care which channel a float belongs to, so four
+// pixels are handled as three vectors of twelve interleaved floats and only
+// the table lookups are scalar. NaN goes to black and inf, whose Reinhard is
+// inf / inf, to white, so the table index always stays in range.
+static void resolve_srgb_run(const pixel* src, unsigned char* dst, int count, float exposure)
+{
+  const unsigned char* lut = srgb_lut();
+  const __m128 scale = _mm_set1_ps(exposure);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 lut_scale = _mm_set1_ps(SRGB_LUT_SIZE - 1.f);
+  const __m128 half = _mm_set1_ps(0.5f);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    const float* f = &src[i].r;
+    alignas(16) int index[12];
+    for (int k = 0; k < 3; k++)
+    {
+      // max and min return their second operand when the first is NaN
+      __m128 v = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(f + k * 4), scale), zero);
+      v = _mm_min_ps(_mm_div_ps(v, _mm_add_ps(v, one)), one);
+      _mm_store_si128((__m128i*)(index + k * 4), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, lut_scale), half)));
+    }
+
+    unsigned char* out = dst + i * 4;
+    for (int p = 0; p < 4; p++)
+    {
+      out[p * 4 + 0] = lut[index[p * 3 + 0]];
+      out[p * 4 + 1] = lut[index[p * 3 + 1]];
+      out[p * 4 + 2] = lut[index[p * 3 + 2]];
+      out[p * 4 + 3] = 255;
+    }
+  }
+
+  for (; i < count; i++)
+  {
+    const float* f = &src[i].r;
+    for (int c = 0; c < 3; c++)
+    {
+      float v = f[c] * exposure;
+      if (!(v > 0.f)) v = 0.f;
+      v = v / (v + 1.f);
+      if (!(v < 1.f)) v = 1.f;
+      dst[i * 4 + c] = lut[int(v * (SRGB_LUT_SIZE - 1) + 0.5f)];
+    }
+    dst[i * 4 + 3] = 255;
+  }
+}
+
+void renderer::resolve(void* target, target_format format)
+{
+  global_worker_pool().parallel_for(tiles_y, 2, [&](int tile_row_begin, int tile_row_end)
+  {
+    int y_end = std::min(tile_row_end * TILE_SIZE, height);
+    for (int y = tile_row_begin * TILE_SIZE; y < y_end; y++)
+    {
+      for (int tx = 0; tx < tiles_x; tx++)
+      {
+        int x = tx * TILE_SIZE;
+        int run = std::min(TILE_SIZE, width - x);
+        const pixel* src = color + tile_index(x, y);
+
+        if (format == target_format::RGB32F)
+        {
+          memcpy((pixel*)target + x + y * width, src, sizeof(pixel) * run);
+        }
+        else if (format == target_format::RGBA8_SRGB)
+        {
+          resolve_srgb_run(src, (unsigned char*)target + (x + y * width) * 4, run, exposure);
+        }
+        else
+        {
+          unsigned char* dst = (unsigned char*)target + (x + y * width) * 4;
+          for (int i = 0; i < run; i++)
+          {
+            dst[i * 4 + 0] = to_unorm8(src[i].r);
+            dst[i * 4 + 1] = to_unorm8(src[i].g);
+            dst[i * 4 + 2] = to_unorm8(src[i].b);
+            dst[i * 4 + 3] = 255;
+          }
+        }
+      }
+    }
+  });
+}
+
+void renderer::triangle(const face& f, const model& m, const model_instance& inst, float intensity)
+{  
+  vec3 verts[3] = { inst.transformed[f.v1], inst.transformed[f.v2], inst.transformed[f.v3] };
 
   vec3 uv_verts[3] = { m.uvs[f.t1], m.uvs[f.t2], m.uvs[f.t3] };
   vec3 normals[3] = { m.normals[f.n1], m.normals[f.n2], m.normals[f.n3] };
@@ -38,6 +393,29 @@ void renderer::triangle(face& f, model& m, pixel* image, float intensity)
   vec3 uv_dir1 = uv_verts[1] - uv_verts[0];
   vec3 uv_dir2 = uv_verts[2] - uv_verts[0];
 
+  // uv is affine across the triangle, so its screen derivatives and the mip
+  // level they select are constant per triangle
+  float lod = 0.f;
+  if (m.texture && !m.texture->empty())
+  {
+    float det = dir1.x * dir2.y - dir2.x * dir1.y;
+    if (fabsf(det) > 1e-6f)
+    {
+      float tw = (float)m.texture->levels[0].width;
+      float th = (float)m.texture->levels[0].height;
+      float du1 = uv_dir1.x * tw, du2 = uv_dir2.x * tw;
+      float dv1 = uv_dir1.y * th, dv2 = uv_dir2.y * th;
+
+      float du_dx = (du1 * dir2.y - du2 * dir1.y) / det;
+      float dv_dx = (dv1 * dir2.y - dv2 * dir1.y) / det;
+      float du_dy = (du2 * dir1.x - du1 * dir2.x) / det;
+      float dv_dy = (dv2 * dir1.x - dv1 * dir2.x) / det;
+
+      float rho_sq = std::max(du_dx * du_dx + dv_dx * dv_dx, du_dy * du_dy + dv_dy * dv_dy);
+      lod = rho_sq > 0 ? 0.5f * log2f(rho_sq) : 0.f;
+    }
+  }
+
   float step_x = 0.4f;
   float step_y = 0.4f;
 
@@ -74,54 +452,209 @@ void renderer::triangle(face& f, model& m, pixel* image, float intensity)
         p.x < 0 || p.y < 0)
         continue;
       
-      int index = int(p.x) + int(p.y)*width;
+      int index = tile_index(int(p.x), int(p.y));
       if (z_buffer[index] < p.z)
       {
         z_buffer[index] = p.z;
-        int dif_index = int(m.d_width*uv_p.x) + m.d_width*int(m.d_height*uv_p.y);
-        if (dif_index < 0) dif_index = 0;
-        if (dif_index >= m.d_width*m.d_height) dif_index = m.d_width*m.d_height - 1;
-        image[index] = m.diffuse ? m.diffuse[dif_index] * intensity : pixel(intensity, intensity, intensity);
+        if (deferred)
+          gbuffer[index] = { uv_p.x, uv_p.y, intensity, lod, current_source };
+        else
+          color[index] = shade(m, uv_p.x, uv_p.y, intensity, lod);
       }
     }
   }
 }
 
-void renderer::draw_triangular_model(model& a_model, pixel* a_image)
+// an orthographic sphere of radius r covers pi r^2 pixels and shows about half
+// of its faces, the finest level under triangles_per_pixel wins
+int renderer::select_lod(const model& a_model, float scale) const
 {
-  for (int i = 0; i < a_model.faces.size(); i++)
-  {
-    quokka::GProfiler()->Start("draw_preparations");
-    face f = a_model.faces[i];
-    vec3 v[3] = { a_model.verts[f.v1], a_model.verts[f.v2], a_model.verts[f.v3] };
-    
-    // transformation
-    //for (vec3 &v : v)
-    //{
-    //  v = v * a_model.scale;
-    //  v = a_model.rot_z*v;
-    //}
+  int level_count = (int)a_model.lods.size();
+  if (level_count <= 1)
+    return 0;
 
-    vec3 e1, e2;
-    e1 = v[1] - v[0];
-    e2 = v[2] - v[0];
+  float radius_px = a_model.radius * scale * std::min(width, height) * 0.5f;
+  float covered = std::min(3.14159265f * radius_px * radius_px, float(width) * height);
+  if (covered < 1.f)
+    return level_count - 1;
 
-    vec3 normal = vec3::cross(e2, e1);
-    normal.normalize();
+  for (int l = 0; l < level_count; l++)
+  {
+    float front_faces = a_model.lods[l].faces.size() * 0.5f;
+    if (front_faces <= triangles_per_pixel * covered)
+      return l;
+  }
+  return level_count - 1;
+}
 
-    vec3 light = { 0, 0, 1 };
+void renderer::draw_triangular_model(model& a_model)
+{
+  {
+    QUOKKA_PROFILE_SCOPE("draw_preparations");
+    a_model.update_visibility(light, select_lod(a_model, a_model.scale));
+  }
 
-    float intensity = vec3::dot(normal, light);
-    quokka::GProfiler()->Stop("draw_preparations");
+  QUOKKA_PROFILE_SCOPE("draw_triangles");
+  draw_triangular_model(a_model, a_model.instance);
+}
 
-    quokka::GProfiler()->Start("draw_triangles");
-    if (intensity > 0)
-      triangle(f, a_model, a_image, intensity);
-    quokka::GProfiler()->Stop("draw_triangles");
-  }
+void renderer::draw_triangular_model(const model& a_model, const model_instance& a_instance)
+{
+  current_source = (int)sources.size();
+  sources.push_back(&a_model);
+
+  int count = (int)a_instance.visible_faces.size();
+  const int* visible = a_instance.visible_faces.data();
+  const float* intensity = a_instance.visible_intensity.data();
+  if (a_model.lods.empty())
+    return;
+  const face* faces = a_model.lods[a_instance.lod].faces.data();
+  for (int i = 0; i < count; i++)
+    triangle(faces[visible[i]], a_model, a_instance, intensity[i]);
 }
 
 void renderer::render(pixel* image, model &m)
 {  
-  draw_triangular_model(m, image);
+  draw_triangular_model(m);
+  resolve(image, target_format::RGB32F);
+}
+
+
+// inverse of cube_strip_direction, used for the pixels left over after the
+// four-wide loop in draw_sky_rows
+void sky_strip_texel(float x, float y, float z, int cube_edge_i, int& tx, int& ty)
+{
+  float ax = fabsf(x), ay = fabsf(y), az = fabsf(z);
+
+  int f;
+  float ma, u, v;
+  if (ax >= ay && ax >= az) { ma = ax; f = x < 0 ? 1 : 0; u = x < 0 ? z : -z; v = y; }
+  else if (ay >= az)        { ma = ay; f = y > 0 ? 3 : 2; u = -x; v = y < 0 ? -z : z; }
+  else                      { ma = az; f = z < 0 ? 5 : 4; u = z < 0 ? x : -x; v = -y; }
+
+  float half_edge = cube_edge_i * 0.5f;
+  float max_texel = cube_edge_i - 1.f;
+  int col = int(std::min(std::max((u / ma + 1.f) * half_edge, 0.f), max_texel));
+  int row = int(std::min(std::max((v / ma + 1.f) * half_edge, 0.f), max_texel));
+
+  tx = f * cube_edge_i + col;
+  ty = row;
+}
+
+static inline __m128 select_ps(__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+void renderer::draw_sky(const sky_camera& camera, const mip_texture& texture)
+{
+  allocate();
+  if (texture.empty())
+  {
+    clear();
+    return;
+  }
+
+  global_worker_pool().parallel_for(height, 16, [&](int row_begin, int row_end)
+  {
+    draw_sky_rows(camera, texture, row_begin, row_end);
+  });
+}
+
+void renderer::draw_sky_rows(const sky_camera& camera, const mip_texture& texture, int row_begin, int row_end)
+{
+  float yaw = M_PI * camera.yaw / 180.f;
+  float pitch = M_PI * camera.pitch / 180.f;
+  float tan_half = tanf(M_PI * camera.fov / 360.f);
+  float aspect = float(width) / height;
+
+  vec3 forward = { cosf(pitch) * cosf(yaw), cosf(pitch) * sinf(yaw), sinf(pitch) };
+  vec3 right = { sinf(yaw), -cosf(yaw), 0.f };
+  vec3 up = { -sinf(pitch) * cosf(yaw), -sinf(pitch) * sinf(yaw), cosf(pitch) };
+
+  // nx(px) = nx_0 + px * nx_step
+  float nx_step = 2.f * tan_half * aspect / width;
+  float nx_0 = (0.5f * 2.f / width - 1.f) * tan_half * aspect;
+
+  // a face texel covers 2 / edge at unit distance, a pixel 2 * tan_half / height
+  const mip_texture::level& lv = texture.levels[texture.pick_level(
+    log2f(texture.levels[0].height * tan_half / height))];
+  int cube_edge_i = lv.height;
+  float half_edge = cube_edge_i * 0.5f;
+
+  const __m128 sign_mask = _mm_set1_ps(-0.f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 half_edge_4 = _mm_set1_ps(half_edge);
+  const __m128 max_texel_4 = _mm_set1_ps(cube_edge_i - 1.f);
+  const __m128 lanes = _mm_set_ps(3.f * nx_step, 2.f * nx_step, nx_step, 0.f);
+  const __m128 rx = _mm_set1_ps(right.x);
+  const __m128 ry = _mm_set1_ps(right.y);
+
+  for (int py = row_begin; py < row_end; py++)
+  {
+    float ny = (1.f - 2.f * (py + 0.5f) / height) * tan_half;
+    float bx = forward.x + up.x * ny;
+    float by = forward.y + up.y * ny;
+    float bz = forward.z + up.z * ny;
+
+    // four pixels starting at a multiple of 4 share one row of a tile
+
+    int px = 0;
+    for (; px + 4 <= width; px += 4)
+    {
+      __m128 nx = _mm_add_ps(_mm_set1_ps(nx_0 + px * nx_step), lanes);
+      __m128 x = _mm_add_ps(_mm_set1_ps(bx), _mm_mul_ps(rx, nx));
+      __m128 y = _mm_add_ps(_mm_set1_ps(by), _mm_mul_ps(ry, nx));
+      __m128 z = _mm_set1_ps(bz);
+
+      __m128 ax = _mm_andnot_ps(sign_mask, x);
+      __m128 ay = _mm_andnot_ps(sign_mask, y);
+      __m128 az = _mm_andnot_ps(sign_mask, z);
+
+      __m128 x_major = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+      __m128 y_major = _mm_andnot_ps(x_major, _mm_cmpge_ps(ay, az));
+
+      __m128 neg_x = _mm_xor_ps(x, sign_mask);
+      __m128 neg_y = _mm_xor_ps(y, sign_mask);
+      __m128 neg_z = _mm_xor_ps(z, sign_mask);
+
+      // same face conventions as sky_strip_texel
+      __m128 u_x = select_ps(_mm_cmplt_ps(x, zero), z, neg_z);
+      __m128 u_z = select_ps(_mm_cmplt_ps(z, zero), x, neg_x);
+      __m128 v_y = select_ps(_mm_cmplt_ps(y, zero), neg_z, z);
+
+      __m128 ma = select_ps(x_major, ax, select_ps(y_major, ay, az));
+      __m128 u = select_ps(x_major, u_x, select_ps(y_major, neg_x, u_z));
+      __m128 v = select_ps(x_major, y, select_ps(y_major, v_y, neg_y));
+
+      __m128 face_x = _mm_and_ps(_mm_cmplt_ps(x, zero), one);
+      __m128 face_y = _mm_add_ps(_mm_set1_ps(2.f), _mm_and_ps(_mm_cmpgt_ps(y, zero), one));
+      __m128 face_z = _mm_add_ps(_mm_set1_ps(4.f), _mm_and_ps(_mm_cmplt_ps(z, zero), one));
+      __m128 f = select_ps(x_major, face_x, select_ps(y_major, face_y, face_z));
+
+      __m128 inv_ma = _mm_div_ps(one, ma);
+      __m128 col = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(u, inv_ma), one), half_edge_4);
+      __m128 row_f = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(v, inv_ma), one), half_edge_4);
+      col = _mm_min_ps(_mm_max_ps(col, zero), max_texel_4);
+      row_f = _mm_min_ps(_mm_max_ps(row_f, zero), max_texel_4);
+
+      alignas(16) int cols[4], rows[4], faces[4];
+      _mm_store_si128((__m128i*)cols, _mm_cvttps_epi32(col));
+      _mm_store_si128((__m128i*)rows, _mm_cvttps_epi32(row_f));
+      _mm_store_si128((__m128i*)faces, _mm_cvttps_epi32(f));
+
+      pixel* dst = color + tile_index(px, py);
+      for (int i = 0; i < 4; i++)
+        dst[i] = lv.texels[lv.index(faces[i] * cube_edge_i + cols[i], rows[i])];
+    }
+
+    for (; px < width; px++)
+    {
+      float nx = nx_0 + px * nx_step;
+      int tx, ty;
+      sky_strip_texel(bx + right.x * nx, by + right.y * nx, bz, cube_edge_i, tx, ty);
+      color[tile_index(px, py)] = lv.texels[lv.index(tx, ty)];
+    }
+  }
 }
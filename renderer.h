@@ -7,6 +7,8 @@
 #include <vector>
 #include "geometry.h"
 
+struct mip_texture;
+
 struct pixel
 {
   float r = 0, g = 0, b = 0;
@@ -23,7 +25,7 @@ struct pixel
     return pixel(r * v, g * v, b * v);
   }
 
-  pixel operator+(pixel& v)
+  pixel operator+(const pixel& v)
   {
     return pixel(this->r + v.r, this->g + v.g, this->b + v.b);
   }
@@ -31,105 +33,187 @@ struct pixel
 
 
 
+struct model;
+
+// vertex setup and culling for one placement of a model, redone only when the
+// transform, the light or the model itself change. Several instances of one
+// model can be drawn at the same time, e.g. by parallel batch views.
+struct model_instance
+{
+  std::vector<vec3> transformed;
+  std::vector<int> visible_faces;
+  std::vector<float> visible_intensity;
+
+  int lod = 0;
+
+  void update(const model& m, float scale, const mat3x3& rot_z, vec3 light, int a_lod = 0);
+
+private:
+  bool valid = false;
+  int model_revision = -1;
+  float cached_scale = 0.f;
+  mat3x3 cached_rot_z;
+  vec3 cached_light = { 0.f, 0.f, 0.f };
+};
+
 struct model
 {
-  std::vector<vec3> verts;
-  std::vector<vec3> normals;
-  std::vector<vec3> uvs;
+  // vertex attributes are not owned, both sky spheres point at the arrays
+  // generated in sky_sphere.h
+  const vec3* verts = nullptr;
+  const vec3* normals = nullptr;
+  const vec3* uvs = nullptr;
+  int vert_count = 0;
   std::vector<face> faces;
 
+  // built by prepare() once the mesh is loaded. Level 0 holds faces, every
+  // further level is a coarser face set over the same vertices.
+  struct lod_level
+  {
+    std::vector<face> faces;
+    std::vector<vec3> face_normals;   // model space, unit length
+  };
+  std::vector<lod_level> lods;
+  float radius = 0.f;               // largest vertex distance from the origin
+  int revision = 0;
+
+  // placement used by renderer::draw_triangular_model(model&)
   float scale = 1.f;
   mat3x3 rot_z = mat3x3::make_z_matrix(0.f);
+  model_instance instance;
 
   void set_rotation(float z_degrees)
   {
     rot_z = mat3x3::make_z_matrix(z_degrees);
   }
 
+  // coarser_lods are face sets from a generator, ordered fine to coarse
+  void prepare(const std::vector<std::vector<face>>& coarser_lods = std::vector<std::vector<face>>());
+  void update_visibility(vec3 light, int lod = 0) { instance.update(*this, scale, rot_z, light, lod); }
+
   pixel* diffuse = nullptr;
   int d_width = 0;
   int d_height = 0;
 
-  void from_file(std::string filename)
-  {
-    verts.clear();
-    faces.clear();
-    normals.clear();
-    uvs.clear();
-
-    std::ifstream file(filename);
-
-    float c_max = 0;
-
-    for (std::string line; std::getline(file, line);)
-    {
-      std::istringstream s_line = std::istringstream(line);
-
-      std::string id;
-      s_line >> id;
-      if (id == "v")
-      {
-        vec3 vert;
-        s_line >> vert.x >> vert.y >> vert.z;
-        if (abs(vert.x) > c_max) c_max = abs(vert.x);
-        if (abs(vert.y) > c_max) c_max = abs(vert.y);
-        if (abs(vert.z) > c_max) c_max = abs(vert.z);
-        verts.push_back(vert);
-      }
-      else
-      if (id == "vt")
-      {
-        vec3 uv;
-        s_line >> uv.x >> uv.y >> uv.z;
-        uvs.push_back(uv);
-      }
-      else
-      if (id == "vn")
-      {
-        vec3 normal;
-        s_line >> normal.x >> normal.y >> normal.z;
-        normals.push_back(normal);
-      }
-      else
-      if (id == "f")
-      {
-        face f;
-        char trash;
-        s_line >> f.v1 >> trash >> f.t1 >> trash >> f.n1;
-        s_line >> f.v2 >> trash >> f.t2 >> trash >> f.n2;
-        s_line >> f.v3 >> trash >> f.t3 >> trash >> f.n3;
-        f.v1--; f.t1--; f.n1--;
-        f.v2--; f.t2--; f.n2--;
-        f.v3--; f.t3--; f.n3--;
-        faces.push_back(f);
-      }
-    }
-
-    float angle_x = 45.f / 180 * 3.14;
-    float angle_z = 45.f / 180 * 3.14;
-
-    for (vec3& v : verts)
-    {
-      v = v / c_max;
-    } 
-
-    file.close();
-  }
+  // mip-mapped copy of diffuse, sampled instead of it when set
+  const mip_texture* texture = nullptr;
+
+  // compile-time sky sphere from sky_sphere.h, the inverted one uses the same
+  // vertices and differs only in winding
+  void from_sky_sphere(bool inverted);
 
   //TGAImage diffuse;
 };
 
+// camera for the analytic sky mode, angles in degrees, z is up
+struct sky_camera
+{
+  float yaw = 0.f;
+  float pitch = 0.f;
+  float fov = 90.f;
+};
+
+// strip texel of level edge cube_edge_i that direction x, y, z looks at, the
+// scalar form of what draw_sky_rows does four pixels at a time
+void sky_strip_texel(float x, float y, float z, int cube_edge_i, int& tx, int& ty);
+
+enum class render_mode
+{
+  MESH = 0,
+  SKY
+};
+
+// what the deferred rasterizer keeps per pixel instead of a colour
+struct gbuffer_sample
+{
+  float u, v;
+  float intensity;
+  float lod;
+  int source;   // index into renderer::sources, -1 for background
+};
+
+// layout of the buffer handed to renderer::resolve
+enum class target_format
+{
+  RGB32F = 0,   // pixel, three floats
+  RGBA8,        // clamped to [0, 1], r g b a bytes
+  RGBA8_SRGB    // exposure, Reinhard and sRGB encoding, r g b a bytes
+};
+
+inline int target_bytes_per_pixel(target_format format)
+{
+  return format == target_format::RGB32F ? (int)sizeof(pixel) : 4;
+}
+
+// for formats that come in as plain ints through the C API
+inline bool is_target_format(int format)
+{
+  return format >= (int)target_format::RGB32F && format <= (int)target_format::RGBA8_SRGB;
+}
+
 struct renderer
 {
+  static const int TILE_SHIFT = 3;
+  static const int TILE_SIZE = 1 << TILE_SHIFT;
+  static const int TILE_PIXELS = TILE_SIZE * TILE_SIZE;
+
   int width = 1024;
   int height = 1024;
 
+  // colour, depth and gbuffer are kept in 8x8 pixel tiles, rows inside a tile
+  // are contiguous, and resolve() writes the linear image the host expects
+  int tiles_x = 0;
+  int tiles_y = 0;
+  pixel* color = nullptr;
   float* z_buffer = nullptr;
 
+  vec3 light = { 0, 0, 1 };
+
+  // LOD selection aims for at most this many front facing triangles per
+  // covered pixel
+  float triangles_per_pixel = 0.05f;
+
+  // scale applied before tonemapping in RGBA8_SRGB output
+  float exposure = 1.f;
+
+  // deferred texturing: triangles only write depth, uv and intensity, and
+  // resolve_deferred() fetches the texture once per visible pixel
+  bool deferred = false;
+  gbuffer_sample* gbuffer = nullptr;
+  std::vector<const model*> sources;
+  int current_source = -1;
+
+  ~renderer() { release(); }
+
+  int tile_index(int x, int y) const
+  {
+    int tile = (y >> TILE_SHIFT) * tiles_x + (x >> TILE_SHIFT);
+    return (tile << (2 * TILE_SHIFT)) + ((y & (TILE_SIZE - 1)) << TILE_SHIFT) + (x & (TILE_SIZE - 1));
+  }
+
+  int padded_pixels() const { return tiles_x * tiles_y * TILE_PIXELS; }
+
+  // reallocates the buffers only when the size actually changes
+  void resize(int a_width, int a_height);
+  void clear();
+  // also starts a new deferred frame
   void clear_z();
+  void resolve_deferred();
+  void resolve(void* target, target_format format);
   void render(pixel* image, model &m);
-  void draw_triangular_model(model& a_model, pixel* a_image);
-  void triangle(face& f, model& m, pixel* image, float intensity);  
+  int select_lod(const model& a_model, float scale) const;
+  void draw_triangular_model(model& a_model);
+  // no profiler scopes, safe to call for different renderers in parallel
+  void draw_triangular_model(const model& a_model, const model_instance& a_instance);
+  void triangle(const face& f, const model& m, const model_instance& inst, float intensity);  
+
+  // one view ray per pixel straight into the cube strip, no geometry
+  void draw_sky(const sky_camera& camera, const mip_texture& texture);
+  void draw_sky_rows(const sky_camera& camera, const mip_texture& texture, int row_begin, int row_end);
+
+private:
+  void allocate();
+  void release();
 };
 
 
@@ -137,3 +221,4 @@ struct renderer
 
 
 
+
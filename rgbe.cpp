@@ -3,6 +3,7 @@
 * IT IS STRICTLY USE AT YOUR OWN RISK.  */
 
 #include "rgbe.h"
+#include "progress.h"
 #include <math.h>
 #include <malloc.h>
 #include <string.h>
@@ -47,6 +48,7 @@ enum rgbe_error_codes {
   rgbe_write_error,
   rgbe_format_error,
   rgbe_memory_error,
+  rgbe_cancelled,
 };
 
 /* default error routine.  change this to change error handling */
@@ -62,6 +64,8 @@ static int rgbe_error(int rgbe_error_code, char *msg)
   case rgbe_format_error:
     fprintf(stderr, "RGBE bad file format: %s\n", msg);
     break;
+  case rgbe_cancelled:
+    break;
   default:
   case rgbe_memory_error:
     fprintf(stderr, "RGBE error: %s\n", msg);
@@ -334,15 +338,19 @@ int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width,
 }
 
 int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
-  int num_scanlines)
+  int num_scanlines, progress_token *progress)
 {
   unsigned char rgbe[4], *scanline_buffer, *ptr, *ptr_end;
   int i, count;
   unsigned char buf[2];
 
-  if ((scanline_width < 8) || (scanline_width > 0x7fff))
+  progress_begin(progress, num_scanlines);
+  if ((scanline_width < 8) || (scanline_width > 0x7fff)) {
     /* run length encoding is not allowed so read flat*/
-    return RGBE_ReadPixels(fp, data, scanline_width*num_scanlines);
+    i = RGBE_ReadPixels(fp, data, scanline_width*num_scanlines);
+    progress_step(progress, num_scanlines);
+    return i;
+  }
   scanline_buffer = NULL;
   /* read in each successive scanline */
   while (num_scanlines > 0) {
@@ -355,7 +363,9 @@ int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
       rgbe2float(&data[0], &data[1], &data[2], rgbe);
       data += RGBE_DATA_SIZE;
       free(scanline_buffer);
-      return RGBE_ReadPixels(fp, data, scanline_width*num_scanlines - 1);
+      i = RGBE_ReadPixels(fp, data, scanline_width*num_scanlines - 1);
+      progress_step(progress, num_scanlines);
+      return i;
     }
     if ((((int)rgbe[2]) << 8 | rgbe[3]) != scanline_width) {
       free(scanline_buffer);
@@ -415,6 +425,10 @@ int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
       data += RGBE_DATA_SIZE;
     }
     num_scanlines--;
+    if (!progress_step(progress)) {
+      free(scanline_buffer);
+      return rgbe_error(rgbe_cancelled, NULL);
+    }
   }
   free(scanline_buffer);
   return RGBE_RETURN_SUCCESS;
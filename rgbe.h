@@ -10,6 +10,8 @@ See rgbe.txt file for more details.
 
 #include <stdio.h>
 
+struct progress_token;
+
 typedef struct {
   int valid;            /* indicate which fields are valid */
   char programtype[16]; /* listed at beginning of file to identify it
@@ -43,7 +45,10 @@ int RGBE_ReadPixels(FILE *fp, float *data, int numpixels);
 /* read or write run length encoded files */
 /* must be called to read or write whole scanlines */
 int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width, int num_scanlines);
-int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width, int num_scanlines);
+/* progress, if given, steps once per scanline; a cancelled read returns
+ * RGBE_RETURN_FAILURE with the scanlines read so far in data */
+int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width, int num_scanlines,
+  progress_token *progress = NULL);
 
 //static void float2rgbe(unsigned char rgbe[4], float red, float green, float blue);
 //static void rgbe2float(float *red, float *green, float *blue, unsigned char rgbe[4])
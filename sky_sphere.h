@@ -0,0 +1,119 @@
+#pragma once
+
+#include "geometry.h"
+
+// Sky sphere generated at compile time. It is a subdivided cube pushed out to
+// the unit sphere, so every triangle lies inside one face of the diffuse strip
+// built by SCube::get_unreal_cubemap and the UVs address that strip directly.
+
+#ifndef SKY_SPHERE_TESSELLATION
+#define SKY_SPHERE_TESSELLATION 16
+#endif
+
+namespace sky_sphere_detail
+{
+  constexpr double csqrt(double x)
+  {
+    double r = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64; i++)
+    {
+      double next = 0.5 * (r + x / r);
+      if (next == r) break;
+      r = next;
+    }
+    return r;
+  }
+}
+
+// direction on the unit cube for strip face f, u runs along the strip columns
+// and v along its rows, both in [-1, 1]
+constexpr void cube_strip_direction(int f, double u, double v, double& x, double& y, double& z)
+{
+  switch (f)
+  {
+  case 0: x = 1;  y = v;  z = -u; break;  // X_P
+  case 1: x = -1; y = v;  z = u;  break;  // X_N
+  case 2: x = -u; y = -1; z = -v; break;  // Y_N
+  case 3: x = -u; y = 1;  z = v;  break;  // Y_P
+  case 4: x = -u; y = -v; z = 1;  break;  // Z_P
+  default: x = u; y = -v; z = -1; break;  // Z_N
+  }
+}
+
+// whether (du x dv) of face f points away from the centre, which decides the
+// winding of its triangles
+constexpr bool cube_strip_face_outward(int f)
+{
+  double cx = 0, cy = 0, cz = 0, ux = 0, uy = 0, uz = 0, vx = 0, vy = 0, vz = 0;
+  cube_strip_direction(f, 0, 0, cx, cy, cz);
+  cube_strip_direction(f, 1, 0, ux, uy, uz);
+  cube_strip_direction(f, 0, 1, vx, vy, vz);
+  ux -= cx; uy -= cy; uz -= cz;
+  vx -= cx; vy -= cy; vz -= cz;
+  return (uy*vz - uz*vy) * cx + (uz*vx - ux*vz) * cy + (ux*vy - uy*vx) * cz > 0;
+}
+
+template<int N>
+struct sky_sphere_mesh
+{
+  static_assert(N > 0, "sky sphere needs at least one segment per face");
+
+  static constexpr int SIDE = N + 1;
+  static constexpr int VERT_COUNT = 6 * SIDE * SIDE;
+  static constexpr int FACE_COUNT = 6 * N * N * 2;
+
+  // positions double as normals, each vertex has its own uv
+  vec3 verts[VERT_COUNT];
+  vec3 uvs[VERT_COUNT];
+  // outward facing, counter-clockwise seen from outside
+  int indices[FACE_COUNT * 3];
+
+  constexpr sky_sphere_mesh() : verts(), uvs(), indices()
+  {
+    // keeps the last row and column inside their own face of the strip
+    const double inset = 0.9999;
+
+    int index = 0;
+    for (int f = 0; f < 6; f++)
+    {
+      for (int t = 0; t < SIDE; t++)
+      {
+        for (int s = 0; s < SIDE; s++)
+        {
+          double x = 0, y = 0, z = 0;
+          cube_strip_direction(f, 2.0 * s / N - 1.0, 2.0 * t / N - 1.0, x, y, z);
+          double l = sky_sphere_detail::csqrt(x*x + y*y + z*z);
+
+          int vi = f * SIDE * SIDE + t * SIDE + s;
+          verts[vi].x = float(x / l);
+          verts[vi].y = float(y / l);
+          verts[vi].z = float(z / l);
+          uvs[vi].x = float((f + inset * s / N) / 6.0);
+          uvs[vi].y = float(inset * t / N);
+          uvs[vi].z = 0.f;
+        }
+      }
+
+      bool outward = cube_strip_face_outward(f);
+
+      for (int t = 0; t < N; t++)
+      {
+        for (int s = 0; s < N; s++)
+        {
+          int a = f * SIDE * SIDE + t * SIDE + s;
+          int b = a + 1;
+          int c = a + SIDE + 1;
+          int d = a + SIDE;
+
+          indices[index++] = a;
+          indices[index++] = outward ? b : c;
+          indices[index++] = outward ? c : b;
+
+          indices[index++] = a;
+          indices[index++] = outward ? c : d;
+          indices[index++] = outward ? d : c;
+        }
+      }
+    }
+  }
+};
@@ -0,0 +1,129 @@
+#include "synthetic_hdr.h"
+#include "rgbe.h"
+#include "worker_pool.h"
+
+#include <math.h>
+#include <vector>
+
+static unsigned int hash(unsigned int x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+static float lattice(int x, int y, unsigned int seed)
+{
+  return (hash((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ seed) & 0xffffff) / float(0xffffff);
+}
+
+// smooth value noise, x wraps at period so the seam at azimuth 0 is closed
+static float value_noise(float x, float y, int period, unsigned int seed)
+{
+  int x0 = (int)floorf(x), y0 = (int)floorf(y);
+  float fx = x - x0, fy = y - y0;
+  fx = fx * fx * (3 - 2 * fx);
+  fy = fy * fy * (3 - 2 * fy);
+
+  int xa = ((x0 % period) + period) % period;
+  int xb = (xa + 1) % period;
+  float a = lattice(xa, y0, seed), b = lattice(xb, y0, seed);
+  float c = lattice(xa, y0 + 1, seed), d = lattice(xb, y0 + 1, seed);
+  return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fy;
+}
+
+struct hot_spot
+{
+  float azimuth, inclination;   // radians
+  float radius;                 // radians
+  float r, g, b;
+};
+
+void make_synthetic_hdr(float* rgb, int width, int height, unsigned int seed)
+{
+  const float pi = 3.14159265f;
+
+  std::vector<hot_spot> spots;
+  for (int i = 0; i < 4; i++)
+  {
+    hot_spot s;
+    s.azimuth = lattice(i, 1, seed) * 2 * pi;
+    s.inclination = (0.15f + 0.35f * lattice(i, 2, seed)) * pi;
+    s.radius = i == 0 ? 0.02f : 0.006f + 0.01f * lattice(i, 3, seed);
+    float power = i == 0 ? 5000.f : 50.f + 200.f * lattice(i, 4, seed);
+    s.r = power;
+    s.g = power * (0.8f + 0.2f * lattice(i, 5, seed));
+    s.b = power * (0.6f + 0.4f * lattice(i, 6, seed));
+    spots.push_back(s);
+  }
+
+  int grid_x = width / 16 > 0 ? width / 16 : 1;
+  int grid_y = height / 8 > 0 ? height / 8 : 1;
+
+  global_worker_pool().parallel_for(height, 16, [&](int row_begin, int row_end)
+  {
+    for (int y = row_begin; y < row_end; y++)
+    {
+      float inclination = (y + 0.5f) / height * pi;
+      float up = cosf(inclination);
+
+      for (int x = 0; x < width; x++)
+      {
+        float azimuth = (x + 0.5f) / width * 2 * pi;
+        float* p = &rgb[(x + y * width) * 3];
+
+        // sky above the horizon, darker ground below
+        float sky = up > 0 ? 0.4f + 1.6f * up : 0.15f + 0.1f * up;
+        p[0] = sky * (0.6f + 0.2f * cosf(azimuth));
+        p[1] = sky * 0.8f;
+        p[2] = sky * (up > 0 ? 1.2f : 0.7f);
+
+        float n = 0, amplitude = 0.5f;
+        for (int octave = 0; octave < 4; octave++)
+        {
+          int period = 8 << octave;
+          float scale = period / (float)width;
+          n += amplitude * value_noise(x * scale, y * scale, period, seed + octave);
+          amplitude *= 0.5f;
+        }
+        p[0] *= 0.5f + n;
+        p[1] *= 0.5f + n;
+        p[2] *= 0.5f + n;
+
+        if (x % grid_x < 2 || y % grid_y < 2)
+          p[0] = p[1] = p[2] = 0.f;
+
+        float sin_i = sinf(inclination);
+        for (const hot_spot& s : spots)
+        {
+          // angle between the texel direction and the spot centre
+          float cos_angle = sin_i * sinf(s.inclination) * cosf(azimuth - s.azimuth) + up * cosf(s.inclination);
+          if (cos_angle > cosf(s.radius))
+          {
+            p[0] += s.r;
+            p[1] += s.g;
+            p[2] += s.b;
+          }
+        }
+      }
+    }
+  });
+}
+
+bool write_synthetic_hdr(const char* filename, int width, int height, unsigned int seed)
+{
+  std::vector<float> rgb((size_t)width * height * 3);
+  make_synthetic_hdr(rgb.data(), width, height, seed);
+
+  FILE* f;
+  if (fopen_s(&f, filename, "wb") != 0 || !f)
+    return false;
+
+  bool ok = RGBE_WriteHeader(f, width, height, NULL) == RGBE_RETURN_SUCCESS &&
+    RGBE_WritePixels_RLE(f, rgb.data(), width, height) == RGBE_RETURN_SUCCESS;
+  fclose(f);
+  return ok;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Procedural equirectangular HDR environments for benchmarks and validation,
+// the same seed always gives the same image. rgb holds width * height * 3
+// floats, the layout RGBE_ReadPixels_RLE produces.
+//
+// The image combines a sky gradient over inclination, a few octaves of value
+// noise, thin black grid lines and small hot spots far above 1.0 like a sun
+// or lamps, so both smooth regions and sharp HDR edges are covered.
+void make_synthetic_hdr(float* rgb, int width, int height, unsigned int seed = 1);
+
+// writes the image as RLE compressed Radiance .hdr, false on I/O failure
+bool write_synthetic_hdr(const char* filename, int width, int height, unsigned int seed = 1);
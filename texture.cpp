@@ -0,0 +1,63 @@
+#include "texture.h"
+#include "worker_pool.h"
+
+static void allocate_level(mip_texture::level& lv, int width, int height)
+{
+  lv.width = width;
+  lv.height = height;
+  lv.tiles_x = (width + mip_texture::TILE_SIZE - 1) >> mip_texture::TILE_SHIFT;
+  int tiles_y = (height + mip_texture::TILE_SIZE - 1) >> mip_texture::TILE_SHIFT;
+  lv.texels.assign(lv.tiles_x * tiles_y * mip_texture::TILE_TEXELS, pixel());
+}
+
+void mip_texture::build(const pixel* strip, int face_edge, int face_count)
+{
+  levels.clear();
+  if (!strip || face_edge <= 0 || face_count <= 0)
+    return;
+
+  int level_count = 1;
+  for (int e = face_edge; e > 1; e /= 2)
+    level_count++;
+  levels.resize(level_count);
+
+  level& base = levels[0];
+  allocate_level(base, face_edge * face_count, face_edge);
+  global_worker_pool().parallel_for(base.height, 32, [&](int row_begin, int row_end)
+  {
+    for (int y = row_begin; y < row_end; y++)
+      for (int x = 0; x < base.width; x++)
+        base.texels[base.index(x, y)] = strip[x + y * base.width];
+  });
+
+  for (int l = 1; l < level_count; l++)
+  {
+    const level& src = levels[l - 1];
+    level& dst = levels[l];
+
+    int src_edge = src.height;
+    int dst_edge = src_edge / 2;
+    allocate_level(dst, dst_edge * face_count, dst_edge);
+
+    global_worker_pool().parallel_for(dst.height, 32, [&](int row_begin, int row_end)
+    {
+      for (int y = row_begin; y < row_end; y++)
+      {
+        int sy0 = y * 2;
+        int sy1 = sy0 + 1 < src_edge ? sy0 + 1 : sy0;
+        for (int x = 0; x < dst.width; x++)
+        {
+          int f = x / dst_edge;
+          int sx0 = f * src_edge + (x - f * dst_edge) * 2;
+          int sx1 = sx0 + 1 < (f + 1) * src_edge ? sx0 + 1 : sx0;
+
+          pixel sum = src.texels[src.index(sx0, sy0)];
+          sum = sum + src.texels[src.index(sx1, sy0)];
+          sum = sum + src.texels[src.index(sx0, sy1)];
+          sum = sum + src.texels[src.index(sx1, sy1)];
+          dst.texels[dst.index(x, y)] = sum / 4;
+        }
+      }
+    });
+  }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "renderer.h"
+
+// Preview texture built from the diffuse strip. Every level of the mip chain
+// is stored in 8x8 texel tiles with Morton order inside a tile, so texels
+// that are close on screen are close in memory as well.
+struct mip_texture
+{
+  static const int TILE_SHIFT = 3;
+  static const int TILE_SIZE = 1 << TILE_SHIFT;
+  static const int TILE_TEXELS = TILE_SIZE * TILE_SIZE;
+
+  struct level
+  {
+    int width = 0;
+    int height = 0;
+    int tiles_x = 0;
+    std::vector<pixel> texels;
+
+    int index(int x, int y) const
+    {
+      int tile = (y >> TILE_SHIFT) * tiles_x + (x >> TILE_SHIFT);
+      return tile * TILE_TEXELS + morton(x & (TILE_SIZE - 1), y & (TILE_SIZE - 1));
+    }
+  };
+
+  // interleaves the three low bits of x and y
+  static int morton(int x, int y)
+  {
+    return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+  }
+
+  std::vector<level> levels;
+
+  // strip is face_count square faces of face_edge texels laid out in a row,
+  // faces are filtered separately so no level bleeds across a face border
+  void build(const pixel* strip, int face_edge, int face_count);
+
+  bool empty() const { return levels.empty(); }
+
+  // lod is log2 of texels per screen pixel on the base level
+  int pick_level(float lod) const
+  {
+    int l = int(lod + 0.5f);
+    if (l < 0) l = 0;
+    if (l >= (int)levels.size()) l = (int)levels.size() - 1;
+    return l;
+  }
+
+  // nearest texel of level l at strip coordinates u, v in [0, 1]
+  pixel fetch(int l, float u, float v) const
+  {
+    const level& lv = levels[l];
+    int x = int(u * lv.width);
+    int y = int(v * lv.height);
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x >= lv.width) x = lv.width - 1;
+    if (y >= lv.height) y = lv.height - 1;
+    return lv.texels[lv.index(x, y)];
+  }
+};
@@ -0,0 +1,461 @@
+// Accuracy harness for the fast paths of the converter, the counterpart of
+// benchmark.cpp: build it from this file and every library source except
+// main.cpp.
+//
+//   validate [--sizes 512,1k] [--seeds 1,2,3] [--filter text] [--dir path]
+//            [--max-abs X] [--max-rel X] [--min-psnr dB] [--max-seam X]
+//
+// Every case runs a fast or lossy path next to the scalar reference on the
+// synthetic corpus (synthetic_hdr.h, one image per size and seed) and reports
+// max abs and rel error, tonemapped PSNR and, for cube outputs, the seam
+// error of every face against the reference cube. Each case carries its own
+// tolerances, the options override them for all selected cases. Exit code 1
+// means a case is out of tolerance, 2 bad arguments or an I/O error.
+//
+// A new fast path gets its own case below that runs it and the code it
+// replaces on the same corpus image.
+
+#include "validation.h"
+#include "synthetic_hdr.h"
+#include "texture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct corpus_image
+{
+  int width = 0, height = 0, edge = 0;
+  unsigned int seed = 0;
+  std::string hdr_path;             // RLE .hdr of source, written once
+  std::vector<pixel> source;        // float image the reference works on
+  SCube reference;                  // make_cube of source, blurred_edges blurred by blur_power
+
+  static const int blur_power = 4;
+};
+
+struct validation_result
+{
+  error_stats error;
+  bool has_seams = false;
+  double seam_reference[6] = {};
+  double seam[6] = {};
+};
+
+struct validation_case
+{
+  const char* name;
+  tolerance limits;
+  std::function<bool(corpus_image&, validation_result&)> run;
+};
+
+static bool read_rgbe(const std::string& path, std::vector<pixel>& out, int& width, int& height)
+{
+  FILE* f;
+  if (fopen_s(&f, path.c_str(), "rb") != 0 || !f)
+    return false;
+  bool ok = RGBE_ReadHeader(f, &width, &height, NULL) == RGBE_RETURN_SUCCESS;
+  if (ok)
+  {
+    out.resize((size_t)width * height);
+    ok = RGBE_ReadPixels_RLE(f, &out[0].r, width, height) == RGBE_RETURN_SUCCESS;
+  }
+  fclose(f);
+  return ok;
+}
+
+static void compare_cubes(corpus_image& image, SCube& test, validation_result& result)
+{
+  size_t face = (size_t)image.edge * image.edge;
+  for (int k = 0; k < 6; k++)
+    result.error.merge(compare_pixels(image.reference.blurred_edges[k], test.blurred_edges[k], face));
+
+  result.has_seams = true;
+  cube_seam_error(image.reference, result.seam_reference);
+  cube_seam_error(test, result.seam);
+}
+
+// RLE decode through rgbe2float against the floats that were encoded,
+// covers the 8 bit shared-exponent quantisation and the decoder itself
+static bool case_rgbe_decode(corpus_image& image, validation_result& result)
+{
+  std::vector<pixel> decoded;
+  int w = 0, h = 0;
+  if (!read_rgbe(image.hdr_path, decoded, w, h) || w != image.width || h != image.height)
+    return false;
+  result.error = compare_pixels(image.source.data(), decoded.data(), decoded.size());
+  return true;
+}
+
+// the whole cube pipeline fed from the decoded file instead of the floats
+static bool case_cube_from_rgbe(corpus_image& image, validation_result& result)
+{
+  std::vector<pixel> decoded;
+  int w = 0, h = 0;
+  if (!read_rgbe(image.hdr_path, decoded, w, h))
+    return false;
+
+  SCube cube;
+  cube.make_cube(decoded.data(), w, h, image.edge, 0.f);
+  cube.blur(corpus_image::blur_power);
+  compare_cubes(image, cube, result);
+  return true;
+}
+
+// RGBA8 DDS output read back against the blurred faces clamped to [0, 1]
+static bool case_dds_rgba8(corpus_image& image, validation_result& result)
+{
+  std::string path = image.hdr_path + ".dds";
+  write_dds_cubemap(path.c_str(), image.reference.blurred_edges, image.edge);
+
+  size_t face = (size_t)image.edge * image.edge;
+  std::vector<unsigned char> data(face * 4 * 6);
+  FILE* f;
+  if (fopen_s(&f, path.c_str(), "rb") != 0 || !f)
+    return false;
+  bool ok = fseek(f, sizeof(DWORD) + sizeof(DDS_HEADER), SEEK_SET) == 0 &&
+    fread(data.data(), 1, data.size(), f) == data.size();
+  fclose(f);
+  remove(path.c_str());
+  if (!ok)
+    return false;
+
+  std::vector<pixel> clamped(face), written(face);
+  for (int k = 0; k < 6; k++)
+  {
+    for (size_t j = 0; j < face; j++)
+    {
+      const pixel& p = image.reference.blurred_edges[k][j];
+      clamped[j] = pixel(std::min(std::max(p.r, 0.f), 1.f), std::min(std::max(p.g, 0.f), 1.f),
+        std::min(std::max(p.b, 0.f), 1.f));
+
+      const unsigned char* bgra = &data[(k * face + j) * 4];
+      written[j] = pixel(bgra[2] / 255.f, bgra[1] / 255.f, bgra[0] / 255.f);
+    }
+    result.error.merge(compare_pixels(clamped.data(), written.data(), face));
+  }
+  return true;
+}
+
+// SSE2 rows of renderer::draw_sky against one sky_strip_texel lookup per
+// pixel, for a few cameras that between them look at every face. The width
+// is not a multiple of 4, so the scalar tail runs as well.
+static bool case_sky_rows(corpus_image& image, validation_result& result)
+{
+  std::unique_ptr<pixel[]> strip(image.reference.get_unreal_cubemap());
+  mip_texture texture;
+  texture.build(strip.get(), image.edge, 6);
+
+  renderer r;
+  r.resize(image.edge + 3, image.edge / 2);
+  std::vector<pixel> drawn((size_t)r.width * r.height), expected(drawn.size());
+
+  const sky_camera cameras[] = { { 0.f, 0.f, 90.f }, { 137.f, 25.f, 70.f }, { -60.f, 80.f, 100.f },
+    { 250.f, -75.f, 60.f } };
+  for (const sky_camera& camera : cameras)
+  {
+    r.draw_sky(camera, texture);
+    r.resolve(drawn.data(), target_format::RGB32F);
+
+    float yaw = M_PI * camera.yaw / 180.f;
+    float pitch = M_PI * camera.pitch / 180.f;
+    float tan_half = tanf(M_PI * camera.fov / 360.f);
+    float aspect = float(r.width) / r.height;
+    vec3 forward = { cosf(pitch) * cosf(yaw), cosf(pitch) * sinf(yaw), sinf(pitch) };
+    vec3 right = { sinf(yaw), -cosf(yaw), 0.f };
+    vec3 up = { -sinf(pitch) * cosf(yaw), -sinf(pitch) * sinf(yaw), cosf(pitch) };
+
+    const mip_texture::level& lv = texture.levels[texture.pick_level(
+      log2f(texture.levels[0].height * tan_half / r.height))];
+    for (int py = 0; py < r.height; py++)
+    {
+      float ny = (1.f - 2.f * (py + 0.5f) / r.height) * tan_half;
+      for (int px = 0; px < r.width; px++)
+      {
+        float nx = (2.f * (px + 0.5f) / r.width - 1.f) * tan_half * aspect;
+        int tx, ty;
+        sky_strip_texel(forward.x + up.x * ny + right.x * nx, forward.y + up.y * ny + right.y * nx,
+          forward.z + up.z * ny, lv.height, tx, ty);
+        expected[px + py * r.width] = lv.texels[lv.index(tx, ty)];
+      }
+    }
+    result.error.merge(compare_pixels(expected.data(), drawn.data(), drawn.size()));
+  }
+  return true;
+}
+
+// the 4096 entry table behind RGBA8_SRGB resolve against exposure, Reinhard
+// and the sRGB curve evaluated in float. The width leaves a partial tile.
+static bool case_srgb_lut(corpus_image& image, validation_result& result)
+{
+  renderer r;
+  r.resize(image.width - 3, image.height);
+  std::vector<unsigned char> bytes((size_t)r.width * r.height * 4);
+  std::vector<pixel> expected((size_t)r.width * r.height), written(expected.size());
+
+  r.clear();
+  for (int y = 0; y < r.height; y++)
+    for (int x = 0; x < r.width; x++)
+      r.color[r.tile_index(x, y)] = image.source[x + y * image.width];
+
+  auto encode = [](float v)
+  {
+    v = v / (v + 1.f);
+    return v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.f / 2.4f) - 0.055f;
+  };
+
+  const float exposures[] = { 0.25f, 1.f, 4.f };
+  for (float exposure : exposures)
+  {
+    r.exposure = exposure;
+    r.resolve(bytes.data(), target_format::RGBA8_SRGB);
+    for (int y = 0; y < r.height; y++)
+    {
+      for (int x = 0; x < r.width; x++)
+      {
+        const pixel& p = image.source[x + y * image.width];
+        size_t i = x + (size_t)y * r.width;
+        expected[i] = pixel(encode(p.r * exposure), encode(p.g * exposure), encode(p.b * exposure));
+        written[i] = pixel(bytes[i * 4] / 255.f, bytes[i * 4 + 1] / 255.f, bytes[i * 4 + 2] / 255.f);
+      }
+    }
+    result.error.merge(compare_pixels(expected.data(), written.data(), expected.size()));
+  }
+  return true;
+}
+
+static std::vector<validation_case> make_cases()
+{
+  std::vector<validation_case> cases;
+
+  // float2rgbe truncates to an 8 bit mantissa of the brightest channel
+  tolerance rgbe;
+  rgbe.max_rel = 1.0 / 128;
+  rgbe.min_psnr = 45;
+  cases.push_back({ "rgbe_decode", rgbe, case_rgbe_decode });
+
+  // nearest sampling can hop to the neighbour texel, so only PSNR and seams
+  // are held tight here
+  tolerance cube;
+  cube.min_psnr = 40;
+  cube.max_seam_growth = 0.05;
+  cases.push_back({ "cube_from_rgbe", cube, case_cube_from_rgbe });
+
+  // the writer truncates, so one step of 1/255 at most
+  tolerance dds;
+  dds.max_abs = 1.0 / 255 + 1e-6;
+  dds.min_psnr = 45;
+  cases.push_back({ "dds_rgba8", dds, case_dds_rgba8 });
+
+  // the four-wide ray setup rounds differently from the scalar one, which may
+  // move a pixel to the neighbouring texel on a texel border
+  tolerance sky;
+  sky.min_psnr = 40;
+  cases.push_back({ "sky_rows", sky, case_sky_rows });
+
+  // rounding of the table index, then of the byte, about 0.9 steps of 1/255
+  tolerance srgb;
+  srgb.max_abs = 1.0 / 255;
+  srgb.min_psnr = 45;
+  cases.push_back({ "srgb_lut", srgb, case_srgb_lut });
+
+  return cases;
+}
+
+struct validate_options
+{
+  std::vector<int> sizes = { 512, 1024 };
+  std::vector<unsigned int> seeds = { 1, 2, 3 };
+  std::string filter;
+  std::string dir = ".";
+  tolerance overrides;    // entries left at their defaults change nothing
+};
+
+static void apply_overrides(tolerance& limits, const tolerance& overrides)
+{
+  tolerance none;
+  if (overrides.max_abs != none.max_abs) limits.max_abs = overrides.max_abs;
+  if (overrides.max_rel != none.max_rel) limits.max_rel = overrides.max_rel;
+  if (overrides.min_psnr != none.min_psnr) limits.min_psnr = overrides.min_psnr;
+  if (overrides.max_seam_growth != none.max_seam_growth) limits.max_seam_growth = overrides.max_seam_growth;
+}
+
+// names the first tolerance the result breaks, nullptr when it passes
+static const char* check(const tolerance& limits, const validation_result& r, int& worst_face)
+{
+  worst_face = 0;
+  double worst_growth = -INFINITY;
+  if (r.has_seams)
+  {
+    for (int k = 0; k < 6; k++)
+    {
+      double growth = r.seam_reference[k] > 0 ? r.seam[k] / r.seam_reference[k] - 1.0 : (r.seam[k] > 0 ? INFINITY : 0.0);
+      if (growth > worst_growth)
+      {
+        worst_growth = growth;
+        worst_face = k;
+      }
+    }
+  }
+
+  if (r.error.max_abs > limits.max_abs) return "max abs";
+  if (r.error.max_rel > limits.max_rel) return "max rel";
+  if (r.error.psnr < limits.min_psnr) return "psnr";
+  if (r.has_seams && worst_growth > limits.max_seam_growth) return "seam";
+  return nullptr;
+}
+
+static int parse_size(const std::string& text)
+{
+  int value = atoi(text.c_str());
+  if (!text.empty() && (text.back() == 'k' || text.back() == 'K'))
+    value *= 1024;
+  return value;
+}
+
+static std::vector<std::string> split(const std::string& list)
+{
+  std::vector<std::string> items;
+  size_t start = 0;
+  while (start <= list.size())
+  {
+    size_t comma = list.find(',', start);
+    if (comma == std::string::npos)
+      comma = list.size();
+    items.push_back(list.substr(start, comma - start));
+    start = comma + 1;
+  }
+  return items;
+}
+
+static bool parse_options(int argc, char** argv, validate_options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--sizes" && has_value)
+    {
+      options.sizes.clear();
+      for (const std::string& item : split(argv[++i]))
+        if (parse_size(item) >= 64)
+          options.sizes.push_back(parse_size(item) & ~63);
+    }
+    else if (arg == "--seeds" && has_value)
+    {
+      options.seeds.clear();
+      for (const std::string& item : split(argv[++i]))
+        if (!item.empty())
+          options.seeds.push_back((unsigned int)strtoul(item.c_str(), nullptr, 10));
+    }
+    else if (arg == "--filter" && has_value)
+      options.filter = argv[++i];
+    else if (arg == "--dir" && has_value)
+      options.dir = argv[++i];
+    else if (arg == "--max-abs" && has_value)
+      options.overrides.max_abs = atof(argv[++i]);
+    else if (arg == "--max-rel" && has_value)
+      options.overrides.max_rel = atof(argv[++i]);
+    else if (arg == "--min-psnr" && has_value)
+      options.overrides.min_psnr = atof(argv[++i]);
+    else if (arg == "--max-seam" && has_value)
+      options.overrides.max_seam_growth = atof(argv[++i]);
+    else
+    {
+      printf("usage: validate [--sizes 512,1k] [--seeds 1,2,3] [--filter text] [--dir path]\n"
+        "                [--max-abs X] [--max-rel X] [--min-psnr dB] [--max-seam X]\n");
+      return false;
+    }
+  }
+  return !options.sizes.empty() && !options.seeds.empty();
+}
+
+int main(int argc, char** argv)
+{
+  validate_options options;
+  if (!parse_options(argc, argv, options))
+    return 2;
+
+  std::vector<validation_case> cases = make_cases();
+  for (validation_case& c : cases)
+    apply_overrides(c.limits, options.overrides);
+
+  printf("%-16s %6s %5s %11s %11s %9s %7s  %s\n", "case", "size", "seed", "max abs", "max rel", "psnr dB", "seam", "verdict");
+
+  int failures = 0, errors = 0;
+  for (int size : options.sizes)
+  {
+    for (unsigned int seed : options.seeds)
+    {
+      corpus_image image;
+      image.width = size;
+      image.height = size / 2;
+      image.edge = size / 4;
+      image.seed = seed;
+      image.hdr_path = options.dir + "/validate_source.hdr";
+
+      std::vector<float> rgb((size_t)image.width * image.height * 3);
+      make_synthetic_hdr(rgb.data(), image.width, image.height, seed);
+      image.source.resize((size_t)image.width * image.height);
+      for (size_t i = 0; i < image.source.size(); i++)
+        image.source[i] = pixel(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+
+      if (!write_synthetic_hdr(image.hdr_path.c_str(), image.width, image.height, seed))
+      {
+        printf("can't write %s\n", image.hdr_path.c_str());
+        return 2;
+      }
+
+      image.reference.make_cube(image.source.data(), image.width, image.height, image.edge, 0.f);
+      image.reference.blur(corpus_image::blur_power);
+
+      for (validation_case& c : cases)
+      {
+        if (!options.filter.empty() && std::string(c.name).find(options.filter) == std::string::npos)
+          continue;
+
+        validation_result result;
+        if (!c.run(image, result))
+        {
+          printf("%-16s %6d %5u  I/O error\n", c.name, size, seed);
+          errors++;
+          continue;
+        }
+
+        int worst_face = 0;
+        const char* broken = check(c.limits, result, worst_face);
+        failures += broken != nullptr;
+
+        printf("%-16s %6d %5u %11.3g %11.3g %9.2f ", c.name, size, seed,
+          result.error.max_abs, result.error.max_rel, result.error.psnr);
+        if (result.has_seams)
+          printf("%+6.1f%%", result.seam_reference[worst_face] > 0 ?
+            100.0 * (result.seam[worst_face] / result.seam_reference[worst_face] - 1.0) : 0.0);
+        else
+          printf("%7s", "-");
+        printf("  %s%s\n", broken ? "FAIL " : "ok", broken ? broken : "");
+
+        if (result.has_seams)
+        {
+          printf("    seam per face, reference / test:");
+          for (int k = 0; k < 6; k++)
+            printf(" %.4g/%.4g", result.seam_reference[k], result.seam[k]);
+          printf("\n");
+        }
+        fflush(stdout);
+      }
+
+      remove(image.hdr_path.c_str());
+    }
+  }
+
+  printf("\n%d failure%s\n", failures, failures == 1 ? "" : "s");
+  if (errors)
+    return 2;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#include "validation.h"
+
+#include <algorithm>
+#include <vector>
+
+void error_stats::merge(const error_stats& other)
+{
+  max_abs = std::max(max_abs, other.max_abs);
+  max_rel = std::max(max_rel, other.max_rel);
+
+  size_t total = count + other.count;
+  if (total == 0)
+    return;
+  double mse = (rmse * rmse * count + other.rmse * other.rmse * other.count) / total;
+  count = total;
+  rmse = sqrt(mse);
+  psnr = mse > 0 ? -10.0 * log10(mse) : INFINITY;
+}
+
+static double tonemap(double v)
+{
+  return v > 0 ? v / (1.0 + v) : 0.0;
+}
+
+error_stats compare_pixels(const pixel* reference, const pixel* test, size_t count)
+{
+  error_stats s;
+  double squared = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    const double ref[3] = { reference[i].r, reference[i].g, reference[i].b };
+    const double out[3] = { test[i].r, test[i].g, test[i].b };
+    double scale = std::max(std::max(fabs(ref[0]), fabs(ref[1])), std::max(fabs(ref[2]), 1e-4));
+
+    for (int c = 0; c < 3; c++)
+    {
+      double diff = fabs(out[c] - ref[c]);
+      s.max_abs = std::max(s.max_abs, diff);
+      s.max_rel = std::max(s.max_rel, diff / scale);
+
+      double tone = tonemap(out[c]) - tonemap(ref[c]);
+      squared += tone * tone;
+    }
+  }
+
+  s.count = count * 3;
+  if (s.count)
+  {
+    double mse = squared / s.count;
+    s.rmse = sqrt(mse);
+    s.psnr = mse > 0 ? -10.0 * log10(mse) : INFINITY;
+  }
+  return s;
+}
+
+static double step(const pixel& a, const pixel& b)
+{
+  return (fabs(a.r - b.r) + fabs(a.g - b.g) + fabs(a.b - b.b)) / 3.0;
+}
+
+void cube_seam_error(SCube& cube, double seam[6])
+{
+  int edge = cube.cube_edge_i;
+  std::vector<pixel> top(edge), bottom(edge), left(edge), right(edge);
+
+  for (int k = 0; k < 6; k++)
+  {
+    cube.assign_borders(top.data(), bottom.data(), left.data(), right.data(), (Surface)k);
+    const pixel* face = cube.blurred_edges[k];
+
+    // top is the row above row 0, left the column before column 0
+    double sum = 0;
+    for (int i = 0; i < edge; i++)
+    {
+      sum += step(face[i], top[i]);
+      sum += step(face[(edge - 1) * edge + i], bottom[i]);
+      sum += step(face[i * edge], left[i]);
+      sum += step(face[i * edge + edge - 1], right[i]);
+    }
+    seam[k] = edge ? sum / (4.0 * edge) : 0.0;
+  }
+}
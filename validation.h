@@ -0,0 +1,38 @@
+#pragma once
+
+#include "hdri_cubemap.h"
+
+#include <math.h>
+#include <stddef.h>
+
+// Error metrics for checking a fast path against the scalar reference, used
+// by validate.cpp. Values are HDR, so PSNR is taken after Reinhard x / (1 + x)
+// with a peak of 1 and relative error is measured against the brightest
+// channel of the reference texel, which is how shared-exponent formats like
+// RGBE bound their error.
+struct error_stats
+{
+  double max_abs = 0;
+  double max_rel = 0;
+  double rmse = 0;          // on tonemapped values
+  double psnr = INFINITY;   // dB, infinite when both are identical
+  size_t count = 0;
+
+  void merge(const error_stats& other);
+};
+
+error_stats compare_pixels(const pixel* reference, const pixel* test, size_t count);
+
+// mean absolute step across the four seams of every face, read from
+// blurred_edges with the same neighbours SCube::blur uses
+void cube_seam_error(SCube& cube, double seam[6]);
+
+// limits a validation case has to stay within
+struct tolerance
+{
+  double max_abs = INFINITY;
+  double max_rel = INFINITY;
+  double min_psnr = 0;
+  // allowed growth of a face's seam error over the reference, 0.05 is 5%
+  double max_seam_growth = INFINITY;
+};
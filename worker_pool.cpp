@@ -0,0 +1,153 @@
+#include "worker_pool.h"
+#include "MemoryTracker.h"
+
+#include <memory>
+
+worker_pool::worker_pool(int thread_count)
+{
+  if (thread_count <= 0)
+  {
+    int hardware = (int)std::thread::hardware_concurrency();
+    thread_count = hardware > 1 ? hardware - 1 : 1;
+  }
+
+  for (int i = 0; i < thread_count; i++)
+    threads.emplace_back(&worker_pool::worker_loop, this);
+}
+
+worker_pool::~worker_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    stopping = true;
+  }
+  jobs_cv.notify_all();
+
+  for (std::thread& t : threads)
+    t.join();
+}
+
+void worker_pool::submit(std::function<void()> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    jobs.push_back(std::move(job));
+  }
+  jobs_cv.notify_one();
+}
+
+void worker_pool::worker_loop()
+{
+  for (;;)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex);
+      jobs_cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (jobs.empty())
+        return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+namespace
+{
+  // shared between the caller and the helpers it queued, the helpers may
+  // outlive the call when the caller drains every chunk first
+  struct parallel_for_state
+  {
+    std::function<void(int, int)> fn;
+    int count = 0;
+    int grain = 1;
+    int memory_tag = 0;   // the caller's, so helpers charge the same subsystem
+    std::atomic<int> next_chunk{ 0 };
+    std::atomic<int> chunks_left{ 0 };
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+
+    void run()
+    {
+      quokka::MemoryTagScope tag(memory_tag);
+      int chunk_count = (count + grain - 1) / grain;
+      for (;;)
+      {
+        int chunk = next_chunk.fetch_add(1);
+        if (chunk >= chunk_count)
+          return;
+
+        int begin = chunk * grain;
+        int end = begin + grain < count ? begin + grain : count;
+        fn(begin, end);
+
+        if (chunks_left.fetch_sub(1) == 1)
+        {
+          std::lock_guard<std::mutex> lock(done_mutex);
+          done_cv.notify_all();
+        }
+      }
+    }
+  };
+}
+
+void worker_pool::parallel_for(int count, int grain, const std::function<void(int, int)>& fn)
+{
+  if (count <= 0)
+    return;
+  if (grain < 1)
+    grain = 1;
+
+  int chunk_count = (count + grain - 1) / grain;
+  if (chunk_count == 1 || threads.empty())
+  {
+    fn(0, count);
+    return;
+  }
+
+  std::shared_ptr<parallel_for_state> state = std::make_shared<parallel_for_state>();
+  state->fn = fn;
+  state->count = count;
+  state->grain = grain;
+  state->memory_tag = quokka::GetMemoryTag();
+  state->chunks_left = chunk_count;
+
+  int helpers = chunk_count - 1 < size() ? chunk_count - 1 : size();
+  for (int i = 0; i < helpers; i++)
+    submit([state] { state->run(); });
+
+  state->run();
+
+  std::unique_lock<std::mutex> lock(state->done_mutex);
+  state->done_cv.wait(lock, [&state] { return state->chunks_left.load() == 0; });
+}
+
+static std::atomic<worker_pool*> global_pool{ nullptr };
+static std::mutex global_pool_mutex;
+
+worker_pool& global_worker_pool()
+{
+  worker_pool* pool = global_pool.load(std::memory_order_acquire);
+  if (pool)
+    return *pool;
+
+  std::lock_guard<std::mutex> lock(global_pool_mutex);
+  pool = global_pool.load(std::memory_order_relaxed);
+  if (!pool)
+  {
+    pool = new worker_pool();
+    global_pool.store(pool, std::memory_order_release);
+  }
+  return *pool;
+}
+
+void shutdown_global_worker_pool()
+{
+  worker_pool* pool;
+  {
+    std::lock_guard<std::mutex> lock(global_pool_mutex);
+    pool = global_pool.exchange(nullptr, std::memory_order_acq_rel);
+  }
+  delete pool;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads shared by the whole library. parallel_for lets the
+// calling thread take chunks as well, so it can be nested safely: a caller
+// never waits on work that nobody is running.
+struct worker_pool
+{
+  // 0 threads means one per hardware thread, minus the caller
+  explicit worker_pool(int thread_count = 0);
+  ~worker_pool();
+
+  int size() const { return (int)threads.size(); }
+
+  void submit(std::function<void()> job);
+
+  // calls fn(begin, end) on chunks of [0, count) no larger than grain and
+  // returns once every chunk has finished
+  void parallel_for(int count, int grain, const std::function<void(int, int)>& fn);
+
+private:
+  void worker_loop();
+
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> jobs;
+  std::mutex jobs_mutex;
+  std::condition_variable jobs_cv;
+  bool stopping = false;
+};
+
+// Created on first use. It is not a static object on purpose: its destructor
+// would join the workers under the loader lock when the DLL is unloaded, and
+// the exiting threads need that lock as well. A host that unloads the library
+// calls shutdown_global_worker_pool() first, once no work is running; the
+// next call to global_worker_pool() starts a new pool.
+worker_pool& global_worker_pool();
+void shutdown_global_worker_pool();